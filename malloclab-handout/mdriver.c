@@ -92,6 +92,9 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* Number of steps a trace is split into for resident set sizes (-r) */
+#define RSS_SAMPLES 10
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* set in read_trace */
@@ -105,6 +108,7 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    size_t rss[RSS_SAMPLES + 1]; /* resident bytes at each step, with -r */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -133,6 +137,7 @@ static enum { DBG_NONE, DBG_CHEAP, DBG_EXPENSIVE } debug_mode = DBG_CHEAP;
 int verbose = 1;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 int onetime_flag = 0;
+static int rss_flag = 0; /* report resident set sizes (set by -r) */
 
 /* by default, no timeouts */
 static int set_timeout = 0;
@@ -176,11 +181,12 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static double eval_mm_util(trace_t *trace, int tracenum, size_t *rss);
 static void eval_mm_speed(void *ptr);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printrss(int n, stats_t *stats);
 static void usage(void);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
@@ -235,7 +241,8 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         if (mm_stats[i].valid) {
             if (verbose > 1)
                 printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
+            mm_stats[i].util = eval_mm_util(trace, i,
+                                            rss_flag ? mm_stats[i].rss : NULL);
             speed_params->trace = trace;
             speed_params->ranges = ranges;
             if (verbose > 1)
@@ -280,7 +287,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hVAlD")) != EOF) {
+    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hVAlDr")) != EOF) {
         switch (c) {
 
         case 'A': /* Hidden Autolab driver argument */
@@ -338,6 +345,10 @@ int main(int argc, char **argv)
             set_timeout = atoi(optarg);
             break;
 
+        case 'r': /* Report resident set sizes over each trace */
+            rss_flag = 1;
+            break;
+
         case 'h': /* Print this message */
             usage();
             exit(0);
@@ -430,6 +441,10 @@ int main(int argc, char **argv)
             printf("\nResults for mm malloc:\n");
             printresults(num_tracefiles, mm_stats);
             printf("\n");
+            if (rss_flag) {
+                printrss(num_tracefiles, mm_stats);
+                printf("\n");
+            }
         }
     }
 
@@ -572,9 +587,11 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap or of a mapped
+       region */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+         (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+        !mem_in_map(lo, hi)) {
         malloc_error(trace, opnum,
                      "Payload (%p:%p) lies outside heap (%p:%p)",
                      lo, hi, mem_heap_lo(), mem_heap_hi());
@@ -977,16 +994,19 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   peak of the heap size plus the bytes in mapped regions (see
+ *   mem_peaksize) while running the student's malloc package on the
+ *   trace. Regions unmapped on free still count at their peak.
  *
  *   A higher number is better: 1 is optimal.
+ *
+ *   If rss is not NULL, the resident set size of the heap and mapped
+ *   regions is stored in it after mm_init and after each tenth of the
+ *   trace.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, size_t *rss)
 {
-    int i;
+    int i, step = 0;
     int index;
     int size, newsize, oldsize;
     int max_total_size = 0;
@@ -998,8 +1018,12 @@ static double eval_mm_util(trace_t *trace, int tracenum)
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
+    if (rss) /* drop the pages earlier runs left resident */
+        mem_release(mem_heap_lo(), MAX_HEAP);
     if (mm_init() < 0)
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
+    if (rss)
+        rss[step++] = mem_residentsize();
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
@@ -1061,11 +1085,16 @@ static double eval_mm_util(trace_t *trace, int tracenum)
         /* update the high-water mark */
         max_total_size = (total_size > max_total_size) ?
             total_size : max_total_size;
+
+        /* sample the resident set at the end of each tenth of the trace */
+        while (rss && step <= RSS_SAMPLES &&
+               (long)(i + 1) * RSS_SAMPLES >= (long)step * trace->num_ops)
+            rss[step++] = mem_residentsize();
     }
 
     printf(".");
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_peaksize());
 }
 
 
@@ -1330,6 +1359,32 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printrss - print the resident set sizes of each trace in KB: the
+ *     largest sample, the last one, and those after mm_init and after
+ *     each tenth of the trace
+ */
+static void printrss(int n, stats_t *stats)
+{
+    int i, j;
+    size_t peak;
+
+    printf("Resident set (KB) after mm_init and each tenth of the trace:\n");
+    printf("%7s%7s  %s\n", "peak", "end", "samples");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid) {
+            printf("%7s%7s  %s\n", "-", "-", stats[i].filename);
+            continue;
+        }
+        for (peak = 0, j = 0; j <= RSS_SAMPLES; j++)
+            peak = (stats[i].rss[j] > peak) ? stats[i].rss[j] : peak;
+        printf("%7zu%7zu ", peak / 1024, stats[i].rss[RSS_SAMPLES] / 1024);
+        for (j = 0; j <= RSS_SAMPLES; j++)
+            printf(" %zu", stats[i].rss[j] / 1024);
+        printf(" %s\n", stats[i].filename);
+    }
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -1375,7 +1430,7 @@ void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
  */
 static void usage(void)
 {
-    fprintf(stderr, "Usage: mdriver [-hlVdD] [-f <file>]\n");
+    fprintf(stderr, "Usage: mdriver [-hlVdDr] [-f <file>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-d <i>     Debug: 0 off; 1 default; 2 lots.\n");
     fprintf(stderr, "\t-D         Equivalent to -d2.\n");
@@ -1386,5 +1441,6 @@ static void usage(void)
     fprintf(stderr, "\t-V         Print diagnostics as each trace is run.\n");
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
+    fprintf(stderr, "\t-r         Report the resident set size over each trace.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
 }
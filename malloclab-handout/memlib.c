@@ -2,7 +2,20 @@
  * memlib.c - a module that simulates the memory system.	Needed because it 
  *						allows us to interleave calls from the student's malloc package 
  *						with the system's malloc package in libc.
+ *
+ * Besides the heap, it hands out mapped regions (mem_map, mem_unmap,
+ * mem_remap), backed by real anonymous mappings. Each region starts with
+ * a map_t linking it into the list of live regions, so the driver can
+ * check payloads in them and mem_reset_brk can drop them. The peak of
+ * the heap size plus the mapped bytes is the footprint the driver uses
+ * for utilization.
+ *
+ * The heap can shrink: mem_sbrk takes negative increments and gives the
+ * pages past the new brk back to the system, as mem_release does for a
+ * range inside the heap. mem_residentsize counts the pages actually in
+ * memory, so the driver can follow the resident set over a trace.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -16,10 +29,25 @@
 #include "memlib.h"
 #include "config.h"
 
+/* Header of a mapped region, in front of the area handed out */
+typedef struct map {
+	struct map *next;
+	struct map *prev;
+	size_t len;						/* Bytes mapped, header included */
+	size_t pad;						/* Keeps the area 16-byte aligned */
+} map_t;
+
 /* private variables */
 static char *heap;
 static char *mem_brk;
 static char *mem_max_addr;
+static map_t *maps;					/* Live mapped regions */
+static size_t mem_mapped;			/* Bytes in them */
+static size_t mem_peak;				/* Peak of heap size plus mem_mapped */
+
+static size_t map_len(size_t size);
+static void update_peak(void);
+static size_t resident(void *ptr, size_t size);
 
 /* 
  * mem_init - initialize the memory system model
@@ -34,42 +62,174 @@ void mem_init(void){
 			0);						/* offset (dunno) */
 	mem_max_addr = heap + MAX_HEAP;
 	mem_brk = heap;					/* heap is empty initially */
+	maps = NULL;
+	mem_mapped = mem_peak = 0;
 }
 
 /* 
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void){
+	mem_reset_brk();
 	munmap(heap, MAX_HEAP);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *		and unmap every mapped region
  */
 void mem_reset_brk(){
+	while (maps) {
+		mem_unmap(maps + 1);
+	}
 	mem_brk = heap;
+	mem_peak = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *		by incr bytes and returns the start address of the new area. In
- *		this model, the heap cannot be shrunk.
+ *		by incr bytes and returns the start address of the new area. A
+ *		negative incr shrinks the heap, releasing the pages past the new
+ *		brk.
  */
 void *mem_sbrk(int incr) {
 	char *old_brk = mem_brk;
 
     // call sbrk() in an attempt to have similar semantics as a real allocator.
-	if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr) ||
-            sbrk(incr) == (void *) -1) {
+    // Never shrink the real break, though: libc malloc may have grown it since.
+	if ( ((mem_brk + incr) < heap) || ((mem_brk + incr) > mem_max_addr) ||
+            (incr > 0 && sbrk(incr) == (void *) -1)) {
 		errno = ENOMEM;
 		fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 		return (void *)-1;
 	}
 
 	mem_brk += incr;
+	if (incr < 0) {
+		mem_release(mem_brk, -incr);
+	}
+	update_peak();
 	return (void *)old_brk;
 }
 
+/*
+ * mem_release - model of madvise(MADV_DONTNEED): give back the whole
+ *		pages within the size bytes at ptr. They read as zero when next
+ *		touched.
+ */
+void mem_release(void *ptr, size_t size) {
+	size_t page = mem_pagesize();
+	char *lo = (char *)(((size_t)ptr + page - 1) & ~(page - 1));
+	char *hi = (char *)(((size_t)ptr + size) & ~(page - 1));
+
+	if (lo < hi) {
+		madvise(lo, hi - lo, MADV_DONTNEED);
+	}
+}
+
+/*
+ * mem_map - model of mmap for an anonymous region of at least size
+ *		bytes. Returns its 16-byte aligned start address, or (void *)-1
+ *		when the heap and the mapped regions would outgrow MAX_HEAP.
+ */
+void *mem_map(size_t size) {
+	size_t len = map_len(size);
+	map_t *mp;
+
+	if (mem_heapsize() + mem_mapped + len > MAX_HEAP ||
+			(mp = mmap(NULL, len, PROT_READ | PROT_WRITE,
+					   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+		errno = ENOMEM;
+		fprintf(stderr, "ERROR: mem_map failed. Ran out of memory...\n");
+		return (void *)-1;
+	}
+	mp->len = len;
+	mp->prev = NULL;
+	mp->next = maps;
+	if (maps) {
+		maps->prev = mp;
+	}
+	maps = mp;
+	mem_mapped += len;
+	update_peak();
+	return (void *)(mp + 1);
+}
+
+/*
+ * mem_unmap - unmap the region starting at ptr, returned by mem_map or
+ *		mem_remap
+ */
+void mem_unmap(void *ptr) {
+	map_t *mp = (map_t *)ptr - 1;
+
+	if (mp->prev) {
+		mp->prev->next = mp->next;
+	}
+	else {
+		maps = mp->next;
+	}
+	if (mp->next) {
+		mp->next->prev = mp->prev;
+	}
+	mem_mapped -= mp->len;
+	munmap(mp, mp->len);
+}
+
+/*
+ * mem_remap - model of mremap: resize the region starting at ptr to at
+ *		least size bytes, moving it if needed. Its contents are kept
+ *		without copying. Returns its new start address, or (void *)-1 on
+ *		failure, when the old region is left as it was.
+ */
+void *mem_remap(void *ptr, size_t size) {
+	map_t *mp = (map_t *)ptr - 1;
+	size_t len = map_len(size);
+
+	if (len > mp->len &&
+			mem_heapsize() + mem_mapped + len - mp->len > MAX_HEAP) {
+		errno = ENOMEM;
+		fprintf(stderr, "ERROR: mem_remap failed. Ran out of memory...\n");
+		return (void *)-1;
+	}
+	if ((mp = mremap(mp, mp->len, len, MREMAP_MAYMOVE)) == MAP_FAILED) {
+		return (void *)-1;
+	}
+	if (mp->prev) {
+		mp->prev->next = mp;
+	}
+	else {
+		maps = mp;
+	}
+	if (mp->next) {
+		mp->next->prev = mp;
+	}
+	mem_mapped += len - mp->len;
+	mp->len = len;
+	update_peak();
+	return (void *)(mp + 1);
+}
+
+/*
+ * mem_regionsize - returns the usable bytes of the region starting at ptr
+ */
+size_t mem_regionsize(void *ptr) {
+	return ((map_t *)ptr - 1)->len - sizeof(map_t);
+}
+
+/*
+ * mem_in_map - whether the bytes lo to hi lie within one mapped region
+ */
+int mem_in_map(void *lo, void *hi) {
+	map_t *mp;
+
+	for (mp = maps; mp; mp = mp->next) {
+		if ((char *)lo >= (char *)(mp + 1) && (char *)hi < (char *)mp + mp->len) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -91,9 +251,83 @@ size_t mem_heapsize() {
 	return (size_t)((void *)mem_brk - (void *)heap);
 }
 
+/*
+ * mem_mapsize() - returns the bytes in mapped regions
+ */
+size_t mem_mapsize() {
+	return mem_mapped;
+}
+
+/*
+ * mem_peaksize() - returns the peak of the heap size plus the bytes in
+ *		mapped regions since the last mem_reset_brk
+ */
+size_t mem_peaksize() {
+	return mem_peak;
+}
+
+/*
+ * mem_residentsize() - returns the bytes of the heap and the mapped
+ *		regions that are resident in memory
+ */
+size_t mem_residentsize() {
+	size_t size = resident(heap, mem_heapsize());
+	map_t *mp;
+
+	for (mp = maps; mp; mp = mp->next) {
+		size += resident(mp, mp->len);
+	}
+	return size;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
 size_t mem_pagesize(){
 	return (size_t)getpagesize();
 }
+
+/*
+ * map_len - bytes to map for a region of size bytes
+ */
+static size_t map_len(size_t size) {
+	size_t page = mem_pagesize();
+
+	return (size + sizeof(map_t) + page - 1) & ~(page - 1);
+}
+
+/*
+ * resident - bytes resident in memory among the pages from page-aligned
+ *		ptr covering size bytes
+ */
+static size_t resident(void *ptr, size_t size) {
+	static unsigned char vec[4096];
+	size_t page = mem_pagesize();
+	size_t n, i, count = 0;
+	char *p = ptr;
+
+	size = (size + page - 1) & ~(page - 1);
+	while (size > 0) {
+		n = size / page < sizeof(vec) ? size / page : sizeof(vec);
+		if (mincore(p, n * page, vec) < 0) {
+			return 0;
+		}
+		for (i = 0; i < n; i++) {
+			count += vec[i] & 1;
+		}
+		p += n * page;
+		size -= n * page;
+	}
+	return count * page;
+}
+
+/*
+ * update_peak - raise mem_peak to the current footprint
+ */
+static void update_peak(void) {
+	size_t size = mem_heapsize() + mem_mapped;
+
+	if (size > mem_peak) {
+		mem_peak = size;
+	}
+}
@@ -8,4 +8,14 @@ void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+void mem_release(void *ptr, size_t size);
+size_t mem_residentsize(void);
+
+void *mem_map(size_t size);
+void mem_unmap(void *ptr);
+void *mem_remap(void *ptr, size_t size);
+size_t mem_regionsize(void *ptr);
+int mem_in_map(void *lo, void *hi);
+size_t mem_mapsize(void);
+size_t mem_peaksize(void);
 
@@ -9,12 +9,52 @@
  * header and footer, link list headers, payload and a epilogue block.
  * Free blocks are connected by different free lists, removed from or inserted
  * into the list due to its size.
- * Each block has 3 bit fields to indicate the allocation of next, previous,
- * and itself.
+ * Each block has bit fields to indicate the allocation of previous and
+ * itself.
  * Each free list is starting at the initial heap, and also ending there.
  *
+ * Small requests (up to SLAB_MAX bytes) of a size class that has seen
+ * SLAB_THRESHOLD of them skip the free lists. They are served from runs:
+ * blocks taken from the heap like any other, carved into equal slots of
+ * one size class, with a bitmap of the free slots. A class's first run
+ * has RUN_MIN_SLOTS slots and each new one twice as many, up to
+ * RUN_MAX_SLOTS or RUN_SIZE bytes. A slot has a one word header (its
+ * offset in the run, with the slot bit 0x4 set) and no footer, so malloc
+ * and free of small blocks are O(1) and touch no neighbors. The runs of
+ * a class with free slots are kept on a doubly linked list, whose head
+ * sits with the class's state at the very start of the heap; a run that
+ * empties goes back to the heap unless it is the only one its class has.
+ * Runs cost space when their slots go unused, so the threshold leaves
+ * classes with few requests on the free lists.
+ *
+ * Requests of MMAP_THRESHOLD bytes or more get a mapped region of their
+ * own (mem_map) instead of growing the heap, and free returns it at
+ * once. Its block header, one word in front of the payload, has both the
+ * slot bit and the previous-allocated bit set, which no heap block or
+ * slot has. realloc resizes such a block with mem_remap, which moves the
+ * pages instead of copying them.
+ *
+ * Freed memory goes back to the system in one pass, run once free has
+ * freed RELEASE_INTERVAL bytes since the last one, never on every free:
+ * memory given back costs a page fault per page when it is reused, so
+ * memory freed and soon reused should stay. The pass shrinks the heap
+ * when its last block is free and TRIM_THRESHOLD bytes or more, keeping
+ * TRIM_PAD bytes of it, and releases (mem_release) the pages between the
+ * links and the footer of every other free block of RELEASE_THRESHOLD
+ * bytes or more. A released block carries the released bit 0x4 until it
+ * is merged or allocated, so the next pass skips it.
+ *
+ * realloc grows a block in place when it can: into a free next block,
+ * past the end of the heap when the block is the last one, or down into
+ * a free previous block, moving the payload with memmove. Only when all
+ * of these fail does it allocate a new block and copy. With
+ * REALLOC_HEADROOM set, a block that grows gets 1/REALLOC_HEADROOM of its
+ * size (at most REALLOC_HEADROOM_MAX bytes) extra, so a block grown a
+ * little at a time is moved rarely, at some cost in utilization.
+ *
  */
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -53,6 +93,7 @@
 #define CHUNKSIZE   (1 << 9)  /* Extend heap by this amount (bytes) */
 
 #define MAX(x, y) ((x) > (y)? (x) : (y))
+#define MIN(x, y) ((x) < (y)? (x) : (y))
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, next_alloc, prev_alloc, alloc)  ((size) | (next_alloc)| (prev_alloc) | (alloc))
@@ -76,10 +117,19 @@
 /* Given hdr ptr p, get and set alloc field from addres p */
 #define GET_PREV_ALLOC(p) (GET(p) & 0x2)
 #define SET_PREV_ALLOC(p) (PUT(p, (GET(p) | 0x2 )));
-#define GET_NEXT_ALLOC(p) (GET(p) & 0x4)
-#define SET_NEXT_ALLOC(p) (PUT(p, (GET(p) | 0x4 )));
 #define SET_PREV_FREE(p)  (PUT(p, (GET(p) & (~0x2))));
-#define SET_NEXT_FREE(p)  (PUT(p, (GET(p) & (~0x4))));
+
+/* Given hdr ptr p, whether the block is a slot in a run */
+#define SLOT        0x4
+#define GET_SLOT(p) (GET(p) & SLOT)
+
+/* Given hdr ptr p of a free block, whether its pages were released */
+#define RELEASED        0x4
+#define GET_RELEASED(p) (GET(p) & RELEASED)
+
+/* Given hdr ptr p, whether the block has a mapped region of its own */
+#define MAPPED        0x6
+#define GET_MAPPED(p) ((GET(p) & MAPPED) == MAPPED)
 
 /* Given block ptr bp, get the pointer of the address of next/prev free block */
 #define NEXT_P(bp) (bp)
@@ -104,10 +154,55 @@
 
 #define LIST_NUM 12         /* The number of lists */
 
+/* Slab runs */
+#define SLAB_MAX       32               /* Largest request served from runs */
+#define SLAB_THRESHOLD 1024             /* Requests of a class before runs */
+#define RUN_SIZE       4096             /* Largest run block size */
+#define RUN_MIN_SLOTS  8                /* Slots in the first run of a class */
+#define RUN_MAX_SLOTS  64               /* Slots the bitmap can track */
+#define RUN_SLOTS      (sizeof(run_t) + WSIZE)  /* First slot header in a run */
+
+/* Mapped blocks */
+#define MMAP_THRESHOLD (128 * 1024)     /* Smallest request mapped alone */
+
+/* Growing blocks: 0 for no headroom, n for 1/n of the size */
+#define REALLOC_HEADROOM     0          /* Extra room a grown block gets */
+#define REALLOC_HEADROOM_MAX (64 * 1024)    /* but no more than this */
+
+/* Giving memory back */
+#define TRIM_THRESHOLD    (1024 * 1024)     /* Free heap top that gets trimmed */
+#define TRIM_PAD          (512 * 1024)      /* Free bytes a trim leaves */
+#define RELEASE_THRESHOLD (1024 * 1024)     /* Free block whose pages go back */
+#define RELEASE_INTERVAL  (4 * 1024 * 1024)  /* Bytes freed between passes */
+
+/* Given slot size, get its class; slots are 16 bytes and up */
+#define SLAB_INDEX(size) (((size) >> 3) - 2)
+#define SLAB_CLASSES     (SLAB_INDEX(ALIGN(SLAB_MAX + WSIZE)) + 1)
+
+/* Header of a run, at the start of its block's payload */
+typedef struct run {
+    struct run *next;       /* Runs of the class with free slots */
+    struct run *prev;
+    unsigned short size;    /* Slot size, header included */
+    unsigned short nslots;
+    unsigned short nfree;
+    unsigned short pad;
+    unsigned long long map; /* Set bits are free slots */
+} run_t;
+
+/* A size class of runs */
+typedef struct {
+    run_t *head;            /* Runs with free slots */
+    size_t nslots;          /* Slots in the next new run */
+    size_t count;           /* Requests seen, up to SLAB_THRESHOLD */
+} slab_class_t;
+
 
 /* Global variants */
 static char *heap_listp = 0;
 static char *heap_basep = 0;
+static slab_class_t *slab_classes = 0;
+static size_t freed_bytes = 0;   /* Freed since the last release pass */
 
 /* Helpers */
 static void *extend_heap(size_t words);
@@ -118,10 +213,19 @@ static void place(void *bp, size_t asize);
 static void insert_block(void *bp, size_t index);
 static void delete_block(void *bp);
 static size_t get_index(size_t size);
+static void *alloc_block(size_t asize);
+static void *slab_alloc(size_t size);
+static void slab_free(void *bp);
+static void run_unlink(run_t *run, size_t index);
+static void *map_alloc(size_t size);
+static void release_free(void);
+static void *grow_block(void *bp, size_t asize, size_t room, size_t copy);
+static void trim_block(void *bp, size_t asize);
 
 void checkHeapStructure();
 void checkEachFreeBlockInList(void *listPtr);
-void checkEachBlockInPayload(void *payloadPtr);
+void checkEachBlockInPayload(void *payloadPtr, int prevAlloc);
+void checkEachRun(run_t *run, size_t index);
 /* Check if in heap */
 static inline int in_heap(const void* p) {
     return p <= mem_heap_hi() && p >= mem_heap_lo();
@@ -135,6 +239,14 @@ static inline int in_heap(const void* p) {
 
 int mm_init(void){
     size_t sizeForInit = (LIST_NUM * 2 + 4) * WSIZE;
+    if ((slab_classes = mem_sbrk(SLAB_CLASSES * sizeof(slab_class_t))) == (void *)-1) {
+        return -1;
+    }
+    for (size_t i = 0; i < SLAB_CLASSES; i++) {
+        slab_classes[i].head = NULL;
+        slab_classes[i].nslots = RUN_MIN_SLOTS;
+        slab_classes[i].count = 0;
+    }
     if ((heap_listp = mem_sbrk(sizeForInit)) == (void *)-1) {
         return -1;
     }
@@ -164,12 +276,17 @@ int mm_init(void){
 
 void *malloc(size_t size){
     size_t asize;
-    size_t extendsize;
     char *bp;
     
     if (size <= 0) {
         return NULL;
     }
+    if (size <= SLAB_MAX && (bp = slab_alloc(size)) != NULL) {
+        return bp;
+    }
+    if (size >= MMAP_THRESHOLD) {
+        return map_alloc(size);
+    }
     
     if (size <= DSIZE + WSIZE) {
         asize = DSIZE * 2;
@@ -178,20 +295,7 @@ void *malloc(size_t size){
         
         asize = DSIZE * ((size + DSIZE + (DSIZE - 1)) / DSIZE);
     }
-    
-    if ((bp=find_fit(asize)) != NULL) {
-        place(bp, asize);
-        return bp;
-    }
-    
-    extendsize = MAX(asize, CHUNKSIZE);
-    
-    if ((bp = extend_heap(extendsize/WSIZE))==NULL) {
-        return NULL;
-    }
-    place(bp, asize);
-    return bp;
-    
+    return alloc_block(asize);
 }
 
 /*
@@ -200,12 +304,25 @@ void *malloc(size_t size){
 void free(void *ptr){
     if(!ptr)
         return;
+    if (GET_MAPPED(HDRP(ptr))) {
+        mem_unmap((char *)ptr - DSIZE);
+        return;
+    }
+    if (GET_SLOT(HDRP(ptr))) {
+        slab_free(ptr);
+        return;
+    }
     
     size_t size = GET_SIZE(HDRP(ptr));
     size_t _prevAlloc = GET_PREV_ALLOC(HDRP(ptr));
+    
     PUT(HDRP(ptr), PACK(size, 0,_prevAlloc, 0));
     PUT(FTRP(ptr), PACK(size, 0,_prevAlloc, 0));
     coalesce(ptr);
+    if ((freed_bytes += size) >= RELEASE_INTERVAL) {
+        release_free();
+        freed_bytes = 0;
+    }
 }
 
 /*
@@ -217,8 +334,8 @@ void *realloc(void *ptr, size_t size){
     
     size_t _newSize = 0;
     size_t _oldSize = 0;
-    size_t _asize = 0;
-    size_t _prevAlloc = 0;
+    size_t _copy = 0;
+    size_t _room = 0;
     void *_ptr;
     if (!ptr) {
         return malloc(size);
@@ -227,8 +344,36 @@ void *realloc(void *ptr, size_t size){
         free(ptr);
         return NULL;
     }
+    if (GET_MAPPED(HDRP(ptr)) && size >= MMAP_THRESHOLD) {
+        if (size + DSIZE <= mem_regionsize((char *)ptr - DSIZE)) {
+            return ptr;
+        }
+        if ((_ptr = mem_remap((char *)ptr - DSIZE, size + DSIZE)) == (void *)-1) {
+            return NULL;
+        }
+        return (char *)_ptr + DSIZE;
+    }
+    if (GET_MAPPED(HDRP(ptr))) {
+        if (!(_ptr = malloc(size))) {
+            return NULL;
+        }
+        memcpy(_ptr, ptr, size);
+        free(ptr);
+        return _ptr;
+    }
+    if (GET_SLOT(HDRP(ptr))) {
+        _oldSize = ((run_t *)((char *)ptr - GET_SIZE(HDRP(ptr))))->size - WSIZE;
+        if (size <= _oldSize) {
+            return ptr;
+        }
+        if (!(_ptr = malloc(size))) {
+            return NULL;
+        }
+        memcpy(_ptr, ptr, _oldSize);
+        free(ptr);
+        return _ptr;
+    }
     _oldSize = GET_SIZE(HDRP(ptr));
-    _prevAlloc = GET_PREV_ALLOC(HDRP(ptr));
     if (size <= (DSIZE + WSIZE)){
         _newSize = 2 * DSIZE;
     }
@@ -239,31 +384,20 @@ void *realloc(void *ptr, size_t size){
     if (_newSize <= _oldSize){
         return ptr;
     }
-    else {
-        if (_asize >= _newSize) {
-            if (_asize - _newSize >= 2 * DSIZE){
-                if (!GET_ALLOC(HDRP(NEXT_BLKP(ptr)))) {
-                    _asize = _oldSize + GET_SIZE(HDRP(NEXT_BLKP(ptr)));
-                    delete_block(NEXT_BLKP(ptr));
-                    PUT(HDRP(ptr), PACK(_newSize, 0,_prevAlloc, 1));
-                    PUT(HDRP(NEXT_BLKP(ptr)), PACK(_asize- _newSize,0, 2, 0));
-                    PUT(FTRP(NEXT_BLKP(ptr)), PACK(_asize -_newSize,0, 2, 0));
-                    SET_PREV_ALLOC(HDRP(NEXT_BLKP(NEXT_BLKP(ptr))));
-                    insert_block(NEXT_BLKP(ptr), get_index(_asize - _newSize));
-                }
-                else{
-                    PUT(HDRP(ptr), PACK(_asize,0, _prevAlloc, 1));
-                    SET_PREV_ALLOC(HDRP(NEXT_BLKP(ptr)));
-                }
-                return ptr;
-            }
+    _copy = MIN(size, _oldSize - WSIZE);
+    if (size < MMAP_THRESHOLD) {
+#if REALLOC_HEADROOM
+        _room = ALIGN(MIN(_newSize / REALLOC_HEADROOM, REALLOC_HEADROOM_MAX));
+#endif
+        if ((_ptr = grow_block(ptr, _newSize, _room, _copy))) {
+            return _ptr;
         }
     }
-    _ptr = malloc(size);
+    _ptr = malloc(size + _room);
     if (!_ptr){
         return NULL;
     }
-    memcpy(_ptr, ptr, _oldSize);
+    memcpy(_ptr, ptr, _copy);
     free(ptr);
     return _ptr;
 }
@@ -277,12 +411,274 @@ void *calloc(size_t nmemb, size_t size){
     void *newptr;
     
     newptr = malloc(bytes);
-    memset(newptr, 0, bytes);
+    if (newptr && !GET_MAPPED(HDRP(newptr))) {   /* Fresh mappings are zero */
+        memset(newptr, 0, bytes);
+    }
     
     return newptr;
 }
 
 
+/*
+ * mm_blocksize - Size of the allocated block holding ptr, header and footer
+ * included. Payloads hold up to this size less DSIZE bytes.
+ */
+size_t mm_blocksize(void *ptr){
+    if (GET_MAPPED(HDRP(ptr))) {
+        return mem_regionsize((char *)ptr - DSIZE);
+    }
+    if (GET_SLOT(HDRP(ptr))) {
+        return ((run_t *)((char *)ptr - GET_SIZE(HDRP(ptr))))->size;
+    }
+    return GET_SIZE(HDRP(ptr));
+}
+
+
+/*
+ * map_alloc - Give a request of size bytes a mapped region of its own.
+ * Return a ptr to the block, NULL when out of memory.
+ */
+static void *map_alloc(size_t size){
+    char *p;
+
+    if ((p = mem_map(size + DSIZE)) == (void *)-1) {
+        return NULL;
+    }
+    PUT(p + WSIZE, PACK(0, SLOT, 0x2, 1));
+    return p + DSIZE;
+}
+
+/*
+ * grow_block - Grow allocated block bp to at least asize bytes, and to
+ * asize + room bytes when there is space, without allocating a new
+ * block: absorb a free next block, extend the heap when bp is its last
+ * block, or also absorb a free previous block and move the first copy
+ * bytes of the payload down to it. Return the block, NULL when it cannot
+ * grow in place.
+ */
+static void *grow_block(void *bp, size_t asize, size_t room, size_t copy){
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    char *next = NEXT_BLKP(bp);
+    char *after = next;
+    char *prev;
+
+    if (!GET_ALLOC(HDRP(next))) {
+        size += GET_SIZE(HDRP(next));
+        after = NEXT_BLKP(next);
+    }
+    if (size < asize && GET_SIZE(HDRP(after)) == 0) {
+        if (extend_heap(MAX(asize + room - size, 2 * DSIZE) / WSIZE) == NULL) {
+            return NULL;
+        }
+        size = GET_SIZE(HDRP(bp)) + GET_SIZE(HDRP(next));
+    }
+    if (size < asize && !prev_alloc &&
+        size + GET_SIZE(HDRP(PREV_BLKP(bp))) >= asize) {
+        prev = PREV_BLKP(bp);
+        delete_block(prev);
+        if (!GET_ALLOC(HDRP(next))) {
+            delete_block(next);
+        }
+        size += GET_SIZE(HDRP(prev));
+        PUT(HDRP(prev), PACK(size, 0, GET_PREV_ALLOC(HDRP(prev)), 1));
+        memmove(prev, bp, copy);
+        trim_block(prev, asize + room);
+        return prev;
+    }
+    if (size < asize) {
+        return NULL;
+    }
+    if (!GET_ALLOC(HDRP(next))) {
+        delete_block(next);
+    }
+    PUT(HDRP(bp), PACK(size, 0, prev_alloc, 1));
+    trim_block(bp, asize + room);
+    return bp;
+}
+
+/*
+ * trim_block - Split what allocated block bp has past asize bytes off
+ * into a free block, when that is big enough to be one. The footer of an
+ * allocated block is never read, so none is written: it could hold
+ * payload bytes a grown block just moved there.
+ */
+static void trim_block(void *bp, size_t asize){
+    size_t size = GET_SIZE(HDRP(bp));
+    char *rest;
+
+    if (size < asize + 2 * DSIZE) {
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+        return;
+    }
+    PUT(HDRP(bp), PACK(asize, 0, GET_PREV_ALLOC(HDRP(bp)), 1));
+    rest = NEXT_BLKP(bp);
+    PUT(HDRP(rest), PACK(size - asize, 0, 2, 0));
+    PUT(FTRP(rest), PACK(size - asize, 0, 2, 0));
+    SET_PREV_FREE(HDRP(NEXT_BLKP(rest)));
+    insert_block(rest, get_index(size - asize));
+}
+
+/*
+ * release_free - Trim a big free block off the end of the heap, then
+ * release the pages inside every free block of RELEASE_THRESHOLD bytes
+ * or more not released yet.
+ */
+static void release_free(void){
+    char *_list = heap_listp + get_index(RELEASE_THRESHOLD) * DSIZE;
+    char *_epilogue = (char *)mem_heap_hi() + 1;
+    char *bp = _epilogue - GET_SIZE(_epilogue - DSIZE);
+    size_t size, trim;
+
+    /* The epilogue's prev-alloc bit says whether the last block is free */
+    if (!GET_PREV_ALLOC(HDRP(_epilogue)) &&
+        (size = GET_SIZE(HDRP(bp))) >= TRIM_THRESHOLD) {
+        /* mem_sbrk takes an int */
+        trim = MIN(size - TRIM_PAD, (size_t)INT_MAX) & ~(mem_pagesize() - 1);
+        if (mem_sbrk(-(int)trim) != (void *)-1) {
+            delete_block(bp);
+            size -= trim;
+            PUT(HDRP(bp), PACK(size, 0, GET_PREV_ALLOC(HDRP(bp)), 0));
+            PUT(FTRP(bp), PACK(size, 0, 0, 0));
+            PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 0, 0, 1));    /* New epilogue */
+            insert_block(bp, get_index(size));
+        }
+    }
+
+    for (; _list != FTRP(heap_listp); _list += DSIZE) {
+        for (bp = NEXT_FREE_P(_list); bp != _list; bp = NEXT_FREE_P(bp)) {
+            if (GET_SIZE(HDRP(bp)) < RELEASE_THRESHOLD ||
+                GET_RELEASED(HDRP(bp))) {
+                continue;
+            }
+            mem_release(bp + DSIZE, FTRP(bp) - (bp + DSIZE));
+            PUT(HDRP(bp), GET(HDRP(bp)) | RELEASED);
+            PUT(FTRP(bp), GET(FTRP(bp)) | RELEASED);
+        }
+    }
+}
+
+/*
+ * alloc_block - Find or make room for a free block of asize bytes and
+ * allocate it. Return a ptr to it, NULL when out of memory.
+ */
+static void *alloc_block(size_t asize){
+    size_t extendsize;
+    char *bp;
+    
+    if ((bp=find_fit(asize)) != NULL) {
+        place(bp, asize);
+        return bp;
+    }
+    
+    extendsize = MAX(asize, CHUNKSIZE);
+    
+    if ((bp = extend_heap(extendsize/WSIZE))==NULL) {
+        return NULL;
+    }
+    place(bp, asize);
+    return bp;
+}
+
+/*
+ * slab_alloc - Take the first free slot of the first run with one in the
+ * class for size, starting a new run when there is none. Return a ptr
+ * to the slot's payload, or NULL when out of memory or when the class
+ * has not seen SLAB_THRESHOLD requests yet and the free lists should
+ * serve it.
+ */
+static void *slab_alloc(size_t size){
+    size_t ssize = ALIGN(size + WSIZE);
+    size_t index, slot, nslots;
+    slab_class_t *cp;
+    run_t *run;
+    char *bp;
+    
+    if (ssize < 2 * DSIZE) {
+        ssize = 2 * DSIZE;
+    }
+    index = SLAB_INDEX(ssize);
+    cp = &slab_classes[index];
+    
+    if (!(run = cp->head)) {
+        if (cp->count < SLAB_THRESHOLD) {
+            cp->count++;
+            return NULL;
+        }
+        nslots = cp->nslots;
+        if (!(run = alloc_block(ALIGN(RUN_SLOTS + nslots * ssize + DSIZE)))) {
+            return NULL;
+        }
+        cp->nslots = MIN(MIN(2 * nslots, RUN_MAX_SLOTS),
+                         (RUN_SIZE - RUN_SLOTS - DSIZE) / ssize);
+        run->size = ssize;
+        run->nslots = run->nfree = nslots;
+        run->map = nslots == 64 ? ~0ULL : (1ULL << nslots) - 1;
+        run->prev = NULL;
+        run->next = NULL;
+        cp->head = run;
+    }
+    
+    slot = __builtin_ctzll(run->map);
+    run->map &= run->map - 1;
+    if (--run->nfree == 0) {
+        run_unlink(run, index);
+    }
+    
+    bp = (char *)run + RUN_SLOTS + WSIZE + slot * ssize;
+    PUT(HDRP(bp), (unsigned int)(bp - (char *)run) | SLOT | 0x1);
+    return bp;
+}
+
+/*
+ * slab_free - Mark the slot at bp free in its run, putting the run back
+ * on its class list if it was full, and freeing the run if it is now
+ * empty and the class has others. A run coming back goes behind the
+ * head, so the run being filled stays first and others can drain.
+ */
+static void slab_free(void *bp){
+    run_t *run = (run_t *)((char *)bp - GET_SIZE(HDRP(bp)));
+    size_t index = SLAB_INDEX(run->size);
+    size_t slot = ((char *)bp - (char *)run - RUN_SLOTS - WSIZE) / run->size;
+    run_t *head;
+    
+    PUT(HDRP(bp), 0);
+    run->map |= 1ULL << slot;
+    if (run->nfree++ == 0) {
+        head = slab_classes[index].head;
+        run->prev = head;
+        run->next = head ? head->next : NULL;
+        if (run->next) {
+            run->next->prev = run;
+        }
+        if (head) {
+            head->next = run;
+        }
+        else {
+            slab_classes[index].head = run;
+        }
+    }
+    else if (run->nfree == run->nslots && (run->prev || run->next)) {
+        run_unlink(run, index);
+        free(run);
+    }
+}
+
+/*
+ * run_unlink - Take a run off its class list.
+ */
+static void run_unlink(run_t *run, size_t index){
+    if (run->prev) {
+        run->prev->next = run->next;
+    }
+    else {
+        slab_classes[index].head = run->next;
+    }
+    if (run->next) {
+        run->next->prev = run->prev;
+    }
+}
+
 /*
  * extend_heap - extend the heap and the unit is word. Return a ptr to the extended memory
  * on success, NULL on error.
@@ -303,7 +699,7 @@ static void *extend_heap(size_t words){
     prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     
     PUT(HDRP(bp), PACK(size,0, prev_alloc, 0));
-    PUT(FTRP(bp), PACK(size,0, 0, 0));
+    PUT(FTRP(bp), PACK(size,0, prev_alloc, 0));
     
     /* epilogue header */
     PUT(HDRP(NEXT_BLKP(bp)), PACK(0,0, prev_alloc, 1));
@@ -386,12 +782,13 @@ static void *find_fit(size_t size){
  */
 static void place(void *bp, size_t size){
     size_t _freeSize = GET_SIZE(HDRP(bp));
+    size_t _released = GET_RELEASED(HDRP(bp));
     delete_block(bp);
     if (_freeSize - size >= 2 * DSIZE) {
         PUT(HDRP(bp), PACK(size,0, GET_PREV_ALLOC(HDRP(bp)), 1));
         PUT(FTRP(bp), PACK(size,0, GET_PREV_ALLOC(HDRP(bp)), 1));
-        PUT(HDRP(NEXT_BLKP(bp)), PACK(_freeSize-size,0, 2, 1));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(_freeSize-size,0, 2, 1));
+        PUT(HDRP(NEXT_BLKP(bp)), PACK(_freeSize-size,_released, 2, 0));
+        PUT(FTRP(NEXT_BLKP(bp)), PACK(_freeSize-size,_released, 2, 0));
         insert_block(NEXT_BLKP(bp), get_index(_freeSize - size));
     }
     else{
@@ -476,10 +873,20 @@ int mm_checkheap(int verbose) {
         checkEachFreeBlockInList(bp+i*DSIZE);
     }
     char *heap_payloadp = NEXT_BLKP(heap_listp);
+    int prevAlloc = 1;
     while (GET_SIZE(HDRP(heap_payloadp))!=0) {
-        checkEachBlockInPayload(heap_payloadp);
+        checkEachBlockInPayload(heap_payloadp, prevAlloc);
+        prevAlloc = GET_ALLOC(HDRP(heap_payloadp));
         heap_payloadp = NEXT_BLKP(heap_payloadp);
     }
+    if (!GET_PREV_ALLOC(HDRP(heap_payloadp)) != !prevAlloc) {
+        printf("The alloc bits of the epilogue and its previous do not match. \n");
+    }
+    for (size_t i = 0; i < SLAB_CLASSES; i++) {
+        for (run_t *run = slab_classes[i].head; run; run = run->next) {
+            checkEachRun(run, i);
+        }
+    }
     return 0;
 }
 
@@ -496,7 +903,7 @@ void checkHeapStructure(){
     if (!GET_ALLOC(FTRP(heap_listp))||!GET_PREV_ALLOC(FTRP(heap_listp))) {
         printf("The prologue footer bit fields are not correct. \n");
     }
-    if (GET_SIZE(HDRP(heap_listp))!=(LIST_NUM-1)*DSIZE) {
+    if (GET_SIZE(HDRP(heap_listp))!=(LIST_NUM+1)*DSIZE) {
         printf("The number of lists is not correct. \n");
     }
     
@@ -509,8 +916,7 @@ void checkHeapStructure(){
 void checkEachFreeBlockInList(void *listPtr){
     char *_currentList = listPtr;
     void *_nextBlock = NEXT_FREE_P(_currentList);
-    size_t max = GET_SIZE(HDRP(listPtr));
-    size_t min = max >> 1;
+    size_t index = (_currentList - heap_listp) / DSIZE;
     while (_nextBlock!=_currentList) {
         if (!ALIGNED(_nextBlock)) {
             printf("Align issue within block[%p] in list[%p]. \n", _nextBlock, listPtr);
@@ -518,13 +924,14 @@ void checkEachFreeBlockInList(void *listPtr){
         if (PREV_FREE_P(NEXT_FREE_P(_nextBlock)) != _nextBlock) {
             printf("Previous and next pointers within block[%p] in list[%p] are not consistent. \n", _nextBlock, listPtr);
         }
-        if (GET(HDRP(_nextBlock)) != GET(FTRP(_nextBlock))){
+        /* Only the header follows the previous block's alloc bit */
+        if ((GET(HDRP(_nextBlock)) ^ GET(FTRP(_nextBlock))) & ~0x2){
             printf("Header and footer mismaches, within block[%p] in list[%p]. \n ",_nextBlock, listPtr);
         }
         if(GET_SIZE(HDRP(_nextBlock))<DSIZE){
             printf("Block[%p] in list[%p] is too small. \n", _nextBlock, listPtr);
         }
-        if (GET_SIZE(HDRP(_nextBlock))>max || GET_SIZE(HDRP(_nextBlock))<min) {
+        if (get_index(GET_SIZE(HDRP(_nextBlock))) != index) {
             printf("Out of range, Block[%p] should not be in list[%p]. \n", _nextBlock, listPtr);
         }
         _nextBlock = NEXT_FREE_P(_nextBlock);
@@ -535,8 +942,10 @@ void checkEachFreeBlockInList(void *listPtr){
 /*
  * checkEachBlockInPayload - check block in heap one by one, dealing with
  * boundaries, header/footer consistency, coalescing, alignment, etc.
+ * prevAlloc is the alloc bit of the block walked before it: an allocated
+ * block has no footer, so PREV_BLKP only works after a free one.
  */
-void checkEachBlockInPayload(void *payloadPtr){
+void checkEachBlockInPayload(void *payloadPtr, int prevAlloc){
     char *bp = payloadPtr;
     if(!in_heap(bp)) {
         printf("Block[%p] is out of heap (%p, %p)\n",bp, mem_heap_lo(), mem_heap_hi());
@@ -544,19 +953,41 @@ void checkEachBlockInPayload(void *payloadPtr){
     if (!ALIGNED(bp)) {
         printf("Align issue within block[%p]. \n", bp);
     }
-    if (GET_ALLOC(HDRP(bp))&&GET_PREV_ALLOC(HDRP(bp))){
+    if (!GET_ALLOC(HDRP(bp))&&!prevAlloc){
         printf("Coalesce should have happend for block[%p] and block[%p]. \n", PREV_BLKP(bp),bp);
     }
-    if (GET_PREV_ALLOC(HDRP(bp))!=GET_ALLOC(HDRP(PREV_BLKP(bp)))){
+    if (!GET_PREV_ALLOC(HDRP(bp))!=!prevAlloc){
         printf("The alloc bits of Block[%p] and its previous do not match. \n", bp);
     }
-    
-    
-    
 }
 
-
-
-
-
-
+/*
+ * checkEachRun - check a run on a class list: size class, free count
+ * against its bitmap, list links and the headers of allocated slots.
+ */
+void checkEachRun(run_t *run, size_t index){
+    size_t nfree = 0;
+    char *bp;
+    if (!in_heap(run) || !GET_ALLOC(HDRP(run)) || GET_SIZE(HDRP(run)) < RUN_SLOTS + run->nslots * run->size) {
+        printf("Run[%p] in class %zu is not an allocated heap block. \n", (void *)run, index);
+        return;
+    }
+    if (run->size != (index + 2) * DSIZE) {
+        printf("Run[%p] has slot size %hu in class %zu. \n", (void *)run, run->size, index);
+    }
+    if (run->next && run->next->prev != run) {
+        printf("Next and previous links of run[%p] are not consistent. \n", (void *)run);
+    }
+    for (size_t slot = 0; slot < run->nslots; slot++) {
+        bp = (char *)run + RUN_SLOTS + WSIZE + slot * run->size;
+        if (run->map & (1ULL << slot)) {
+            nfree++;
+        }
+        else if (!GET_SLOT(HDRP(bp)) || GET_SIZE(HDRP(bp)) != (size_t)(bp - (char *)run)) {
+            printf("Slot[%p] in run[%p] has a bad header. \n", (void *)bp, (void *)run);
+        }
+    }
+    if (!nfree || nfree != run->nfree) {
+        printf("Run[%p] counts %hu free slots, its bitmap %zu. \n", (void *)run, run->nfree, nfree);
+    }
+}
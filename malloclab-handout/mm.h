@@ -19,6 +19,7 @@ extern void *calloc (size_t nmemb, size_t size);
 #endif
 
 extern int mm_init(void);
+extern size_t mm_blocksize(void *ptr);
 
 /* This is largely for debugging.  You can do what you want with the
    verbose flag; we don't care. */
@@ -0,0 +1,250 @@
+/*
+ * mm_mt.c
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ * A thread-safe allocator on top of mm.c. The segregated-list heap in
+ * mm.c stays the central heap, guarded by one mutex. In front of it each
+ * thread keeps a cache of small free blocks: one singly linked list per
+ * size class, linked through the payloads, which it uses without any
+ * locking. When a thread's list is empty it takes the lock once and
+ * allocates TCACHE_BATCH blocks of that class; when a list grows past
+ * TCACHE_COUNT it returns TCACHE_BATCH of them under one lock. Cached
+ * blocks stay allocated as far as mm.c knows, so its heap and checker
+ * are unchanged. A block is filed by its actual size, which can exceed
+ * the class it was allocated for when mm.c did not split it, so any block
+ * in a list is big enough for that list's class. Blocks may be freed by
+ * any thread; they join the freeing thread's cache. A thread's cache goes
+ * back to the heap when it exits. Larger blocks go straight to the heap.
+ *
+ */
+#include <pthread.h>
+#include <string.h>
+
+#include "mm.h"
+#include "mm_mt.h"
+
+/* Basic sizes, as in mm.c */
+#define WSIZE       4
+#define DSIZE       8
+
+/* Class of a block size no larger than TCACHE_MAX */
+#define CLASS(size) (((size) - 2 * DSIZE) / DSIZE)
+
+/* Free blocks a thread holds on to */
+typedef struct {
+    void *head[TCACHE_CLASSES];
+    unsigned count[TCACHE_CLASSES];
+    int registered;     /* Flushed at thread exit */
+} tcache_t;
+
+/* Global variants */
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t tcache_key;
+static __thread tcache_t tcache;
+
+/* Helpers */
+static size_t adjust(size_t size);
+static void attach(tcache_t *tc);
+static int refill(tcache_t *tc, size_t index);
+static void flush(tcache_t *tc, size_t index, unsigned n);
+static void flush_all(void *arg);
+
+/* Next block in a cache list */
+#define NEXT_CACHED(bp) (*(void **)(bp))
+
+
+/*
+ * mm_mt_init - Initialize the central heap and the per-thread caches.
+ * Call it once, before any thread allocates. Return -1 on error, 0 on
+ * success.
+ */
+int mm_mt_init(void){
+    if (pthread_key_create(&tcache_key, flush_all)) {
+        return -1;
+    }
+    return mm_init();
+}
+
+/*
+ * mm_mt_malloc - Allocate from this thread's cache when the block is
+ * small, refilling it from the heap when empty, and from the heap
+ * otherwise. Returns NULL for a zero size or when out of memory.
+ */
+void *mm_mt_malloc(size_t size){
+    tcache_t *tc = &tcache;
+    size_t asize, index;
+    void *bp;
+
+    if (size == 0) {
+        return NULL;
+    }
+    asize = adjust(size);
+    if (asize > TCACHE_MAX) {
+        pthread_mutex_lock(&heap_lock);
+        bp = mm_malloc(size);
+        pthread_mutex_unlock(&heap_lock);
+        return bp;
+    }
+
+    index = CLASS(asize);
+    if (!tc->head[index] && !refill(tc, index)) {
+        return NULL;
+    }
+    bp = tc->head[index];
+    tc->head[index] = NEXT_CACHED(bp);
+    tc->count[index]--;
+    return bp;
+}
+
+/*
+ * mm_mt_free - Keep a small block in this thread's cache, returning a
+ * batch to the heap when the cache is full; free others to the heap.
+ */
+void mm_mt_free(void *ptr){
+    tcache_t *tc = &tcache;
+    size_t size, index;
+
+    if (!ptr) {
+        return;
+    }
+    size = mm_blocksize(ptr);
+    if (size > TCACHE_MAX) {
+        pthread_mutex_lock(&heap_lock);
+        mm_free(ptr);
+        pthread_mutex_unlock(&heap_lock);
+        return;
+    }
+
+    index = CLASS(size);
+    attach(tc);
+    NEXT_CACHED(ptr) = tc->head[index];
+    tc->head[index] = ptr;
+    if (++tc->count[index] > TCACHE_COUNT) {
+        flush(tc, index, TCACHE_BATCH);
+    }
+}
+
+/*
+ * mm_mt_realloc - Keep the block when it is already big enough, otherwise
+ * move it to a new one. Behaves like malloc for a NULL ptr and like free
+ * for a zero size.
+ */
+void *mm_mt_realloc(void *ptr, size_t size){
+    size_t oldSize;
+    void *newptr;
+
+    if (!ptr) {
+        return mm_mt_malloc(size);
+    }
+    if (!size) {
+        mm_mt_free(ptr);
+        return NULL;
+    }
+    oldSize = mm_blocksize(ptr) - DSIZE;
+    if (size <= oldSize) {
+        return ptr;
+    }
+    if (!(newptr = mm_mt_malloc(size))) {
+        return NULL;
+    }
+    memcpy(newptr, ptr, oldSize);
+    mm_mt_free(ptr);
+    return newptr;
+}
+
+/*
+ * mm_mt_calloc - Allocate zeroed space for nmemb objects of size bytes.
+ */
+void *mm_mt_calloc(size_t nmemb, size_t size){
+    size_t bytes = nmemb * size;
+    void *newptr;
+
+    if (size && bytes / size != nmemb) {
+        return NULL;
+    }
+    if ((newptr = mm_mt_malloc(bytes))) {
+        memset(newptr, 0, bytes);
+    }
+    return newptr;
+}
+
+
+/*
+ * adjust - Block size mm.c allocates for a request of size bytes.
+ */
+static size_t adjust(size_t size){
+    if (size <= DSIZE + WSIZE) {
+        return DSIZE * 2;
+    }
+    return DSIZE * ((size + DSIZE + (DSIZE - 1)) / DSIZE);
+}
+
+/*
+ * attach - Register this thread's cache for flushing at thread exit, the
+ * first time it takes a block.
+ */
+static void attach(tcache_t *tc){
+    if (!tc->registered) {
+        pthread_setspecific(tcache_key, tc);
+        tc->registered = 1;
+    }
+}
+
+/*
+ * refill - Allocate TCACHE_BATCH blocks for the cache list index under
+ * one lock, asking for the largest request the class serves. A block
+ * mm.c did not split is filed by its actual size, as mm_mt_free would,
+ * unless that is too big to cache. Return the number of blocks added
+ * to list index.
+ */
+static int refill(tcache_t *tc, size_t index){
+    size_t size = index * DSIZE + DSIZE, bsize, i;
+    void *bp;
+    int n;
+
+    attach(tc);
+    pthread_mutex_lock(&heap_lock);
+    for (n = 0; n < TCACHE_BATCH; ) {
+        if (!(bp = mm_malloc(size))) {
+            break;
+        }
+        bsize = mm_blocksize(bp);
+        i = bsize > TCACHE_MAX ? index : CLASS(bsize);
+        NEXT_CACHED(bp) = tc->head[i];
+        tc->head[i] = bp;
+        tc->count[i]++;
+        n += (i == index);
+    }
+    pthread_mutex_unlock(&heap_lock);
+    return n;
+}
+
+/*
+ * flush - Free up to n blocks from the cache list index under one lock.
+ */
+static void flush(tcache_t *tc, size_t index, unsigned n){
+    void *bp;
+
+    pthread_mutex_lock(&heap_lock);
+    while (n-- > 0 && (bp = tc->head[index])) {
+        tc->head[index] = NEXT_CACHED(bp);
+        tc->count[index]--;
+        mm_free(bp);
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+/*
+ * flush_all - Return every cached block to the heap when a thread exits.
+ */
+static void flush_all(void *arg){
+    tcache_t *tc = arg;
+    size_t i;
+
+    for (i = 0; i < TCACHE_CLASSES; i++) {
+        flush(tc, i, tc->count[i]);
+    }
+    tc->registered = 0;
+}
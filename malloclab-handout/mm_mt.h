@@ -0,0 +1,26 @@
+/*
+ * mm_mt.h - Thread-safe allocator built on mm.c, with per-thread caches.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ */
+#ifndef __MM_MT_H__
+#define __MM_MT_H__
+
+#include <stddef.h>
+
+/* Blocks (header and footer included) up to TCACHE_MAX bytes are cached
+   per thread, in one list per DSIZE-sized class */
+#define TCACHE_MAX     256
+#define TCACHE_CLASSES ((TCACHE_MAX - 16) / 8 + 1)
+#define TCACHE_COUNT   64       /* Most blocks a thread keeps per class */
+#define TCACHE_BATCH   32       /* Blocks moved to or from the heap at once */
+
+int mm_mt_init(void);
+void *mm_mt_malloc(size_t size);
+void mm_mt_free(void *ptr);
+void *mm_mt_realloc(void *ptr, size_t size);
+void *mm_mt_calloc(size_t nmemb, size_t size);
+
+#endif /* __MM_MT_H__ */
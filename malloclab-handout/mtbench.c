@@ -0,0 +1,203 @@
+/*
+ * mtbench.c - Multithreaded malloc/free benchmark of mm_mt.c against the
+ *             C library allocator.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ * Each thread owns SLOTS pointers and, for -d seconds, picks a random
+ * slot and frees the block in it or allocates a new one there, writing
+ * to its first bytes. Most requests are small (16 to 256 bytes); with
+ * -l, that percentage are large (up to 4 KB) and go past the thread
+ * caches to the central heap. With -x, threads free each other's
+ * blocks: every thread works on its neighbor's slots half of the time.
+ * The run repeats for 1, 2, 4, ... up to -t threads, for each
+ * allocator, and reports operations per second.
+ *
+ * usage: mtbench [-t max threads] [-d secs] [-l large percent] [-x]
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memlib.h"
+#include "mm_mt.h"
+
+#define MAX_THREADS 64
+#define SLOTS 1024
+#define SMALL_MAX 256
+#define LARGE_MAX 4096
+
+/* An allocator to measure */
+typedef struct {
+    const char *name;
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+} allocator_t;
+
+/* Per-thread state, on its own cache lines */
+typedef struct {
+    int id;
+    void **slots;
+    unsigned long ops;
+} __attribute__((aligned(64))) worker_t;
+
+static const allocator_t allocators[] = {
+    {"libc", malloc, free},
+    {"mm_mt", mm_mt_malloc, mm_mt_free},
+};
+
+static const allocator_t *alloc;
+static worker_t workers[MAX_THREADS];
+static int nthreads, largepct = 0, cross = 0;
+static volatile int running;
+static pthread_mutex_t slot_lock[MAX_THREADS];
+
+static double now(void);
+static double run(const allocator_t *ap, int n, int secs);
+static void *worker(void *vargp);
+
+
+int main(int argc, char **argv){
+    int c, n, secs = 1, maxthreads = 32;
+    size_t i;
+
+    while ((c = getopt(argc, argv, "t:d:l:x")) != -1) {
+        switch (c) {
+        case 't': maxthreads = atoi(optarg); break;
+        case 'd': secs = atoi(optarg); break;
+        case 'l': largepct = atoi(optarg); break;
+        case 'x': cross = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-t max threads] [-d secs] "
+                    "[-l large percent] [-x]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (maxthreads < 1 || maxthreads > MAX_THREADS) {
+        maxthreads = MAX_THREADS;
+    }
+
+    mem_init();
+    if (mm_mt_init() < 0) {
+        fprintf(stderr, "mm_mt_init failed\n");
+        exit(1);
+    }
+    for (n = 0; n < MAX_THREADS; n++) {
+        workers[n].slots = calloc(SLOTS, sizeof(void *));
+        pthread_mutex_init(&slot_lock[n], NULL);
+    }
+
+    printf("%d%% large, %s, %ds per run, ops/s\n", largepct,
+           cross ? "cross-thread frees" : "thread-local frees", secs);
+    printf("threads");
+    for (i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++) {
+        printf(" %12s", allocators[i].name);
+    }
+    printf("\n");
+    for (n = 1; n <= maxthreads; n = n * 2 > maxthreads && n < maxthreads ?
+                                       maxthreads : n * 2) {
+        printf("%7d", n);
+        for (i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++) {
+            printf(" %12.0f", run(&allocators[i], n, secs));
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+static double now(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * run - Run n threads on allocator ap for secs seconds, then free what
+ * they left. Returns operations per second.
+ */
+static double run(const allocator_t *ap, int n, int secs){
+    pthread_t tid[MAX_THREADS];
+    unsigned long ops = 0;
+    double t;
+    int i, j;
+
+    alloc = ap;
+    nthreads = n;
+    running = 1;
+    for (i = 0; i < n; i++) {
+        workers[i].id = i;
+        workers[i].ops = 0;
+    }
+    for (i = 0; i < n; i++) {
+        pthread_create(&tid[i], NULL, worker, &workers[i]);
+    }
+    t = now();
+    sleep(secs);
+    running = 0;
+    for (i = 0; i < n; i++) {
+        pthread_join(tid[i], NULL);
+        ops += workers[i].ops;
+    }
+    t = now() - t;
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < SLOTS; j++) {
+            ap->free(workers[i].slots[j]);
+            workers[i].slots[j] = NULL;
+        }
+    }
+    return ops / t;
+}
+
+/*
+ * worker - Free or allocate in random slots until told to stop. With
+ * cross-thread frees, slots are locked, since two threads share them.
+ */
+static void *worker(void *vargp){
+    worker_t *wp = vargp, *owner;
+    pthread_mutex_t *lock;
+    unsigned x = 2463534242u + wp->id * 7919u;
+    unsigned long ops = 0;
+    size_t size;
+    void **slot;
+
+    while (running) {
+        /* xorshift32 */
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        owner = cross && (x & 1) ? &workers[(wp->id + 1) % nthreads] : wp;
+        slot = &owner->slots[(x >> 1) % SLOTS];
+        lock = &slot_lock[owner - workers];
+        if (cross) {
+            pthread_mutex_lock(lock);
+        }
+        if (*slot) {
+            alloc->free(*slot);
+            *slot = NULL;
+        }
+        else {
+            if ((x >> 12) % 100 < (unsigned)largepct) {
+                size = SMALL_MAX + (x >> 16) % (LARGE_MAX - SMALL_MAX);
+            }
+            else {
+                size = 16 + (x >> 16) % (SMALL_MAX - 16);
+            }
+            if ((*slot = alloc->malloc(size))) {
+                memset(*slot, 0, size < 64 ? size : 64);
+            }
+        }
+        if (cross) {
+            pthread_mutex_unlock(lock);
+        }
+        ops++;
+    }
+    wp->ops = ops;
+    return NULL;
+}
@@ -0,0 +1,214 @@
+/*
+ * cache.c - Shared in-memory web object cache for the proxy.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ * Objects are spread over CACHE_SHARDS shards by a hash of their key, and
+ * each shard is a small hash table with its own readers-writers lock, so
+ * threads working on different objects rarely touch the same lock. A hit
+ * takes only its shard's read lock: it copies the object out and sets
+ * the object's CLOCK bit, a store that racing readers can only repeat.
+ *
+ * Eviction approximates LRU with CLOCK. Each shard keeps its objects in a
+ * ring with a hand; the hand clears set bits as it passes and evicts the
+ * first object whose bit is clear, i.e. one not hit since the hand last
+ * went by. New objects go right behind the hand. When the total size
+ * would exceed MAX_CACHE_SIZE, inserts evict from the shards in turn, so
+ * the shards together behave like one clock and no shard lock is ever
+ * held while waiting for another.
+ *
+ */
+
+#include "cache.h"
+
+/* A shard, on its own cache lines */
+typedef struct {
+    pthread_rwlock_t lock;
+    cache_object_t *buckets[CACHE_BUCKETS];
+    cache_object_t *hand;       /* Next object CLOCK looks at, NULL if empty */
+} __attribute__((aligned(64))) cache_shard_t;
+
+/* Global cache state */
+static cache_shard_t shards[CACHE_SHARDS];
+static size_t cache_size = 0;           /* Bytes in all shards, atomic */
+static unsigned evict_shard = 0;        /* Shard to evict from next, atomic */
+
+/* Helpers */
+static unsigned hash(const char *key);
+static cache_object_t *lookup(cache_shard_t *sp, const char *key, unsigned h);
+static int evict(void);
+static void free_object(cache_object_t *obj);
+
+
+/*
+ * cache_init - Initialize the empty cache and its locks.
+ */
+void cache_init(void) {
+    int i;
+
+    for (i = 0; i < CACHE_SHARDS; i++) {
+        pthread_rwlock_init(&shards[i].lock, NULL);
+        memset(shards[i].buckets, 0, sizeof(shards[i].buckets));
+        shards[i].hand = NULL;
+    }
+    cache_size = 0;
+    evict_shard = 0;
+}
+
+/*
+ * cache_find - Look up key and copy the object into buf, which must hold
+ *          at least MAX_OBJECT_SIZE bytes. Stores the size in *sizep.
+ *          Returns 1 on hit, 0 on miss.
+ */
+int cache_find(const char *key, char *buf, size_t *sizep) {
+    unsigned h = hash(key);
+    cache_shard_t *sp = &shards[h & (CACHE_SHARDS - 1)];
+    cache_object_t *obj;
+    int hit = 0;
+
+    pthread_rwlock_rdlock(&sp->lock);
+    if ((obj = lookup(sp, key, h)) != NULL) {
+        memcpy(buf, obj->data, obj->size);
+        *sizep = obj->size;
+        /* Only store when it changes, so hot objects stay read-shared */
+        if (!obj->referenced) {
+            obj->referenced = 1;
+        }
+        hit = 1;
+    }
+    pthread_rwlock_unlock(&sp->lock);
+    return hit;
+}
+
+/*
+ * cache_insert - Copy an object into the cache, evicting old objects
+ *          until it fits. Objects larger than MAX_OBJECT_SIZE are ignored.
+ */
+void cache_insert(const char *key, const char *data, size_t size) {
+    unsigned h = hash(key);
+    cache_shard_t *sp = &shards[h & (CACHE_SHARDS - 1)];
+    cache_object_t *obj, **bp;
+
+    if (size > MAX_OBJECT_SIZE) {
+        return;
+    }
+
+    obj = Malloc(sizeof(cache_object_t));
+    obj->key = Malloc(strlen(key) + 1);
+    strcpy(obj->key, key);
+    obj->data = Malloc(size);
+    memcpy(obj->data, data, size);
+    obj->size = size;
+    obj->hash = h;
+    obj->referenced = 0;
+
+    /* Claim the space first, so concurrent inserts cannot overshoot */
+    __sync_add_and_fetch(&cache_size, size);
+    while (cache_size > MAX_CACHE_SIZE && evict())
+        ;
+
+    pthread_rwlock_wrlock(&sp->lock);
+    /* Another thread may have fetched the same object meanwhile */
+    if (lookup(sp, key, h) != NULL) {
+        pthread_rwlock_unlock(&sp->lock);
+        __sync_sub_and_fetch(&cache_size, size);
+        free_object(obj);
+        return;
+    }
+    bp = &sp->buckets[(h / CACHE_SHARDS) & (CACHE_BUCKETS - 1)];
+    obj->chain = *bp;
+    *bp = obj;
+    if (sp->hand) {
+        obj->next = sp->hand;
+        obj->prev = sp->hand->prev;
+        obj->prev->next = obj;
+        sp->hand->prev = obj;
+    }
+    else {
+        obj->next = obj->prev = obj;
+        sp->hand = obj;
+    }
+    pthread_rwlock_unlock(&sp->lock);
+}
+
+
+/*
+ * hash - FNV-1a hash of key.
+ */
+static unsigned hash(const char *key) {
+    unsigned h = 2166136261u;
+
+    while (*key) {
+        h = (h ^ (unsigned char)*key++) * 16777619u;
+    }
+    return h;
+}
+
+/*
+ * lookup - Find the object with key, whose hash is h, in shard sp.
+ *          Caller must hold its lock.
+ */
+static cache_object_t *lookup(cache_shard_t *sp, const char *key, unsigned h) {
+    cache_object_t *obj;
+
+    obj = sp->buckets[(h / CACHE_SHARDS) & (CACHE_BUCKETS - 1)];
+    for (; obj; obj = obj->chain) {
+        if (obj->hash == h && !strcmp(obj->key, key)) {
+            return obj;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * evict - Remove the object the next nonempty shard's CLOCK hand picks.
+ *          Returns 0 if every shard is empty.
+ */
+static int evict(void) {
+    cache_shard_t *sp;
+    cache_object_t *victim, **bp;
+    int i;
+
+    for (i = 0; i < CACHE_SHARDS; i++) {
+        sp = &shards[__sync_fetch_and_add(&evict_shard, 1) & (CACHE_SHARDS - 1)];
+        pthread_rwlock_wrlock(&sp->lock);
+        if (!(victim = sp->hand)) {
+            pthread_rwlock_unlock(&sp->lock);
+            continue;
+        }
+        while (victim->referenced) {
+            victim->referenced = 0;
+            victim = victim->next;
+        }
+
+        if (victim->next == victim) {
+            sp->hand = NULL;
+        }
+        else {
+            victim->prev->next = victim->next;
+            victim->next->prev = victim->prev;
+            sp->hand = victim->next;
+        }
+        bp = &sp->buckets[(victim->hash / CACHE_SHARDS) & (CACHE_BUCKETS - 1)];
+        while (*bp != victim) {
+            bp = &(*bp)->chain;
+        }
+        *bp = victim->chain;
+        pthread_rwlock_unlock(&sp->lock);
+
+        __sync_sub_and_fetch(&cache_size, victim->size);
+        free_object(victim);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * free_object - Free an object no longer in the cache.
+ */
+static void free_object(cache_object_t *obj) {
+    Free(obj->data);
+    Free(obj->key);
+    Free(obj);
+}
@@ -0,0 +1,39 @@
+/*
+ * cache.h - Shared in-memory web object cache for the proxy.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "csapp.h"
+
+/* Recommended max cache and object sizes */
+#define MAX_CACHE_SIZE 1049000
+#define MAX_OBJECT_SIZE 102400
+
+/* The cache is split into independently locked shards, CACHE_SHARDS of
+   them, each hashing keys into CACHE_BUCKETS chains (both powers of 2) */
+#define CACHE_SHARDS 32
+#define CACHE_BUCKETS 64
+
+/* One cached web object, keyed by host:port/path */
+typedef struct cache_object {
+    char *key;                  /* host:port/path */
+    char *data;                 /* Raw response bytes */
+    size_t size;                /* Bytes in data */
+    unsigned hash;              /* Hash of key */
+    volatile int referenced;    /* CLOCK bit, set by hits */
+    struct cache_object *chain; /* Next in its hash bucket */
+    struct cache_object *prev;  /* Neighbors in the shard's CLOCK ring */
+    struct cache_object *next;
+} cache_object_t;
+
+/* Cache interface */
+void cache_init(void);
+int cache_find(const char *key, char *buf, size_t *sizep);
+void cache_insert(const char *key, const char *data, size_t size);
+
+#endif /* __CACHE_H__ */
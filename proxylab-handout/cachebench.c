@@ -0,0 +1,142 @@
+/*
+ * cachebench.c - Multithreaded microbenchmark of the proxy's cache.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ * Fills the cache with -k objects of -s bytes, then for 1, 2, 4, ... up
+ * to -t threads has every thread look up random keys for -d seconds and
+ * reports lookups per second in total and per thread. With -w, that
+ * percentage of operations insert a new object instead, which makes
+ * the cache evict. With -1 all threads look up one hot key.
+ *
+ * usage: cachebench [-t max threads] [-d secs] [-k keys] [-s object size]
+ *                   [-w insert percent] [-1]
+ */
+
+#include "csapp.h"
+#include "cache.h"
+
+#define DEFAULT_KEYS 256
+#define DEFAULT_SIZE 1024
+#define KEY_FMT "localhost:8000/object/%d"
+
+static int nkeys = DEFAULT_KEYS, objsize = DEFAULT_SIZE, writepct = 0;
+static int hotkey = 0;
+static volatile int running;
+
+/* Per-thread result, on its own cache line */
+typedef struct {
+    unsigned long ops, hits;
+    int id;
+} __attribute__((aligned(64))) result_t;
+
+static double now(void);
+static void *worker(void *vargp);
+
+
+int main(int argc, char **argv) {
+    int c, i, n, maxthreads = 0, secs = 2;
+    pthread_t tid[256];
+    result_t *results;
+    unsigned long ops, hits;
+    char key[MAXLINE], *data;
+    double t;
+
+    while ((c = getopt(argc, argv, "t:d:k:s:w:1")) != -1) {
+        switch (c) {
+        case 't': maxthreads = atoi(optarg); break;
+        case 'd': secs = atoi(optarg); break;
+        case 'k': nkeys = atoi(optarg); break;
+        case 's': objsize = atoi(optarg); break;
+        case 'w': writepct = atoi(optarg); break;
+        case '1': hotkey = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-t max threads] [-d secs] [-k keys] "
+                    "[-s object size] [-w insert percent] [-1]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (maxthreads <= 0) {
+        maxthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (maxthreads > 256) {
+        maxthreads = 256;
+    }
+    if (objsize <= 0 || objsize > MAX_OBJECT_SIZE || nkeys <= 0) {
+        app_error("bad object size or key count");
+    }
+
+    cache_init();
+    data = Calloc(1, objsize);
+    for (i = 0; i < nkeys; i++) {
+        sprintf(key, KEY_FMT, i);
+        cache_insert(key, data, objsize);
+    }
+    results = Calloc(256, sizeof(result_t));
+
+    printf("%d keys of %d bytes, %d%% inserts%s, %d shards, %ds per run\n",
+           nkeys, objsize, writepct, hotkey ? ", one hot key" : "",
+           CACHE_SHARDS, secs);
+    printf("threads    lookups/s   per thread   hit rate\n");
+    for (n = 1; n <= maxthreads; n = n * 2 > maxthreads && n < maxthreads ?
+                                        maxthreads : n * 2) {
+        running = 1;
+        for (i = 0; i < n; i++) {
+            results[i].ops = results[i].hits = 0;
+            results[i].id = i;
+            Pthread_create(&tid[i], NULL, worker, &results[i]);
+        }
+        t = now();
+        sleep(secs);
+        running = 0;
+        ops = hits = 0;
+        for (i = 0; i < n; i++) {
+            Pthread_join(tid[i], NULL);
+            ops += results[i].ops;
+            hits += results[i].hits;
+        }
+        t = now() - t;
+        printf("%7d %12.0f %12.0f %9.1f%%\n", n, ops / t, ops / t / n,
+               ops ? 100.0 * hits / ops : 0.0);
+    }
+    return 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * worker - Look up (or insert) random keys until told to stop.
+ */
+static void *worker(void *vargp) {
+    result_t *rp = vargp;
+    char key[MAXLINE], *buf = Malloc(MAX_OBJECT_SIZE);
+    unsigned long ops = 0, hits = 0;
+    unsigned x = 2463534242u + rp->id * 7919u;
+    size_t size;
+
+    while (running) {
+        /* xorshift32 */
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        if (writepct && x % 100 < (unsigned)writepct) {
+            sprintf(key, KEY_FMT, nkeys + (int)(x >> 8));
+            cache_insert(key, buf, objsize);
+        }
+        else {
+            sprintf(key, KEY_FMT, hotkey ? 0 : (int)((x >> 8) % nkeys));
+            hits += cache_find(key, buf, &size);
+        }
+        ops++;
+    }
+    rp->ops = ops;
+    rp->hits = hits;
+    Free(buf);
+    return NULL;
+}
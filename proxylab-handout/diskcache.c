@@ -0,0 +1,476 @@
+/*
+ * diskcache.c - Persistent response cache on local disk for the proxy.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ * Responses are appended to segment files (seg-00000001, ...) in the
+ * cache directory and never modified. A record is a small header, the
+ * key and the response, with our own Content-Length already in it:
+ *
+ *   magic | keylen | datalen | hdrend | datacheck | check | key | data
+ *
+ * Every segment is mapped read-only in full, so a hit is written to the
+ * client straight from the page cache with one writev, and an in-memory
+ * hash index maps keys to (segment, offset). Space is reserved under the
+ * lock and the record written outside it, so appends run in parallel.
+ * When the files outgrow the budget the oldest segment is deleted with
+ * everything in it (FIFO, like any log), once no hit still uses it.
+ *
+ * At startup the index is rebuilt by walking the record headers of each
+ * segment in order: check covers the header fields and the key, and
+ * bodies are skipped over, never read. Later records win, and a torn
+ * record (a crash mid-append) ends its segment, which is cut there. A
+ * body that never reached the disk can still pass that scan as zeros,
+ * so datacheck covers the data, and the first hit on a record found at
+ * startup verifies it; a bad one is dropped from the index.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "diskcache.h"
+#include "http.h"
+#include "stats.h"
+
+#define DISK_MAGIC 0x32435850u  /* "PXC2" */
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+/* On-disk record header, followed by the key and the data */
+typedef struct {
+    uint32_t magic;
+    uint32_t keylen;
+    uint32_t datalen;
+    uint32_t hdrend;
+    uint32_t datacheck; /* Over the data */
+    uint32_t check;     /* Over the fields above and the key */
+} record_t;
+
+typedef struct segment {
+    unsigned int id;
+    int fd;
+    char *map;          /* DISK_SEGMENT_SIZE bytes, read-only */
+    size_t size;        /* Bytes appended or reserved */
+    int refs;           /* Pending appends and hits being sent */
+    int dead;           /* Deleted, freed with the last reference */
+    struct segment *next;
+} segment_t;
+
+/* Index entry */
+typedef struct entry {
+    char *key;
+    size_t keylen;
+    segment_t *seg;
+    size_t off;         /* Of the data in the segment */
+    size_t len;
+    size_t hdrend;
+    uint32_t datacheck;
+    int verified;       /* The data matched datacheck */
+    struct entry *next;
+} entry_t;
+
+/* Global state, all guarded by mutex */
+static int enabled = 0;
+static char *cache_dir;
+static size_t max_bytes, total_bytes;
+static segment_t *oldest = NULL, *active = NULL;
+static unsigned int next_id = 1;
+static entry_t **buckets;
+static sem_t mutex;
+
+/* Helpers */
+static uint32_t hash(const char *p, size_t n, uint32_t h);
+static uint32_t checksum(record_t *rp, const char *key);
+static segment_t *open_segment(unsigned int id, int create);
+static void scan_segment(segment_t *sp, size_t filesize, int *nobjects);
+static segment_t *new_segment(void);
+static entry_t **index_find(const char *key, size_t keylen);
+static void index_put(const char *key, size_t keylen, segment_t *sp,
+                      size_t off, size_t len, size_t hdrend,
+                      uint32_t datacheck, int verified);
+static void evict(void);
+static void put_segment(segment_t *sp);
+static int compare_ids(const void *a, const void *b);
+
+
+/*
+ * disk_cache_init - Use dir (created if needed) for a cache of at most
+ *          maxbytes, indexing whatever an earlier run left there.
+ *
+ *  Return 0 on success, -1 on error (the disk cache then stays off).
+ */
+int disk_cache_init(const char *dir, size_t maxbytes) {
+    DIR *dp;
+    struct dirent *de;
+    struct stat sb;
+    segment_t *sp;
+    unsigned int id, *ids = NULL;
+    int i, nids = 0, cap = 0, nobjects = 0;
+    unsigned long start = stats_now();
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        return -1;
+    }
+    if (!(dp = opendir(dir))) {
+        return -1;
+    }
+    cache_dir = Malloc(strlen(dir) + 1);
+    strcpy(cache_dir, dir);
+    max_bytes = maxbytes;
+    buckets = Calloc(DISK_BUCKETS, sizeof(entry_t *));
+    Sem_init(&mutex, 0, 1);
+
+    /* Segments, oldest first */
+    while ((de = readdir(dp))) {
+        if (sscanf(de->d_name, "seg-%u", &id) == 1) {
+            if (nids == cap) {
+                cap = cap ? 2 * cap : 64;
+                ids = Realloc(ids, cap * sizeof(unsigned int));
+            }
+            ids[nids++] = id;
+        }
+    }
+    closedir(dp);
+    qsort(ids, nids, sizeof(unsigned int), compare_ids);
+
+    for (i = 0; i < nids; i++) {
+        if (!(sp = open_segment(ids[i], 0))) {
+            continue;
+        }
+        if (fstat(sp->fd, &sb) == 0) {
+            scan_segment(sp, sb.st_size, &nobjects);
+        }
+        total_bytes += sp->size;
+        next_id = ids[i] + 1;
+    }
+    if (ids) {
+        Free(ids);
+    }
+    evict();
+    enabled = 1;
+
+    printf("Disk cache %s: %d objects in %d segments, %zu MB, indexed in %.1f ms\n",
+           dir, nobjects, nids, total_bytes >> 20, (stats_now() - start) / 1e6);
+    fflush(stdout);
+    return 0;
+}
+
+/*
+ * disk_cache_find - Look up key. On a hit the response is described in
+ *          *op and stays mapped until disk_cache_release(op). A record
+ *          not verified yet is checked first, outside the lock.
+ *
+ *  Return 1 on hit, 0 on miss.
+ */
+int disk_cache_find(const char *key, disk_object_t *op) {
+    size_t keylen = strlen(key);
+    entry_t *ep, **pp;
+    uint32_t datacheck;
+    int verify, ok;
+
+    if (!enabled) {
+        return 0;
+    }
+    P(&mutex);
+    if ((ep = *index_find(key, keylen))) {
+        ep->seg->refs++;
+        op->segment = ep->seg;
+        op->data = ep->seg->map + ep->off;
+        op->len = ep->len;
+        op->hdrend = ep->hdrend;
+        datacheck = ep->datacheck;
+        verify = !ep->verified;
+    }
+    V(&mutex);
+    if (!ep || !verify) {
+        return ep != NULL;
+    }
+
+    ok = hash(op->data, op->len, 2166136261u) == datacheck;
+
+    /* The entry may have been replaced or evicted meanwhile */
+    P(&mutex);
+    pp = index_find(key, keylen);
+    if ((ep = *pp) && ep->seg->map + ep->off == op->data) {
+        if (ok) {
+            ep->verified = 1;
+        }
+        else {
+            *pp = ep->next;
+            Free(ep->key);
+            Free(ep);
+        }
+    }
+    if (!ok) {
+        put_segment(op->segment);
+    }
+    V(&mutex);
+    return ok;
+}
+
+/*
+ * disk_cache_release - Done sending a hit.
+ */
+void disk_cache_release(disk_object_t *op) {
+    P(&mutex);
+    put_segment(op->segment);
+    V(&mutex);
+}
+
+/*
+ * disk_cache_insert - Append a response (as stored in the memory cache:
+ *          no Connection header) to the current segment and index it.
+ */
+void disk_cache_insert(const char *key, char *object, size_t len) {
+    static const char pad[8];
+    char length[MAXLINE];
+    struct iovec iov[6];
+    record_t rec;
+    segment_t *sp;
+    ssize_t hdrend;
+    size_t keylen = strlen(key), linelen = 0, total, off;
+    int haslength, n = 0, ok;
+
+    if (!enabled || (hdrend = http_object_header(object, len, &haslength)) < 0) {
+        return;
+    }
+    if (!haslength) {
+        linelen = sprintf(length, "Content-Length: %zu\r\n", len - hdrend - 2);
+    }
+
+    rec.magic = DISK_MAGIC;
+    rec.keylen = keylen;
+    rec.datalen = len + linelen;
+    rec.hdrend = hdrend + linelen;
+    rec.datacheck = hash(object, hdrend, 2166136261u);
+    rec.datacheck = hash(length, linelen, rec.datacheck);
+    rec.datacheck = hash(object + hdrend, len - hdrend, rec.datacheck);
+    rec.check = checksum(&rec, key);
+    total = ALIGN8(sizeof(record_t) + keylen + rec.datalen);
+    if (total > DISK_SEGMENT_SIZE) {
+        return;
+    }
+
+    iov[n].iov_base = &rec;
+    iov[n++].iov_len = sizeof(record_t);
+    iov[n].iov_base = (void *)key;
+    iov[n++].iov_len = keylen;
+    iov[n].iov_base = object;
+    iov[n++].iov_len = hdrend;
+    if (linelen) {
+        iov[n].iov_base = length;
+        iov[n++].iov_len = linelen;
+    }
+    iov[n].iov_base = object + hdrend;
+    iov[n++].iov_len = len - hdrend;
+    iov[n].iov_base = (void *)pad;
+    iov[n++].iov_len = total - (sizeof(record_t) + keylen + rec.datalen);
+
+    /* Reserve room, then write without the lock */
+    P(&mutex);
+    if ((!active || active->size + total > DISK_SEGMENT_SIZE) && !new_segment()) {
+        V(&mutex);
+        return;
+    }
+    sp = active;
+    off = sp->size;
+    sp->size += total;
+    total_bytes += total;
+    sp->refs++;
+    V(&mutex);
+
+    ok = pwritev(sp->fd, iov, n, off) == total;
+
+    P(&mutex);
+    if (ok && !sp->dead) {
+        index_put(key, keylen, sp, off + sizeof(record_t) + keylen,
+                  rec.datalen, rec.hdrend, rec.datacheck, 1);
+    }
+    put_segment(sp);
+    evict();
+    V(&mutex);
+}
+
+
+/*
+ * hash - FNV-1a, continuing from h
+ */
+static uint32_t hash(const char *p, size_t n, uint32_t h) {
+    while (n--) {
+        h = (h ^ (unsigned char)*p++) * 16777619u;
+    }
+    return h;
+}
+
+/*
+ * checksum - Of a record's header fields and key
+ */
+static uint32_t checksum(record_t *rp, const char *key) {
+    uint32_t h = hash((char *)rp, offsetof(record_t, check), 2166136261u);
+
+    return hash(key, rp->keylen, h);
+}
+
+/*
+ * open_segment - Open (or create) segment id and map it.
+ */
+static segment_t *open_segment(unsigned int id, int create) {
+    char path[MAXLINE];
+    segment_t *sp;
+    int fd;
+    void *map;
+
+    snprintf(path, MAXLINE, "%s/seg-%08u", cache_dir, id);
+    if ((fd = open(path, create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0644)) < 0) {
+        return NULL;
+    }
+    map = mmap(NULL, DISK_SEGMENT_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        Close(fd);
+        return NULL;
+    }
+
+    sp = Calloc(1, sizeof(segment_t));
+    sp->id = id;
+    sp->fd = fd;
+    sp->map = map;
+    if (active) {
+        active->next = sp;
+    }
+    else {
+        oldest = sp;
+    }
+    active = sp;
+    return sp;
+}
+
+/*
+ * scan_segment - Index the records of a segment read from disk, and cut
+ *          off anything after the last good one.
+ */
+static void scan_segment(segment_t *sp, size_t filesize, int *nobjects) {
+    record_t *rp;
+    size_t off = 0, end;
+
+    while (off + sizeof(record_t) <= filesize) {
+        rp = (record_t *)(sp->map + off);
+        end = off + sizeof(record_t) + (size_t)rp->keylen + rp->datalen;
+        if (rp->magic != DISK_MAGIC || end > filesize ||
+            rp->hdrend > rp->datalen ||
+            rp->check != checksum(rp, sp->map + off + sizeof(record_t))) {
+            break;
+        }
+        index_put(sp->map + off + sizeof(record_t), rp->keylen, sp,
+                  off + sizeof(record_t) + rp->keylen, rp->datalen, rp->hdrend,
+                  rp->datacheck, 0);
+        (*nobjects)++;
+        off = ALIGN8(end);
+    }
+    if (off < filesize && ftruncate(sp->fd, off) < 0) {
+        off = filesize;     /* Leave it; appends go after the junk */
+    }
+    sp->size = off;
+}
+
+/*
+ * new_segment - Start appending to a new segment. Caller holds mutex.
+ */
+static segment_t *new_segment(void) {
+    return open_segment(next_id++, 1);
+}
+
+/*
+ * index_find - Find the link to key's entry, or the NULL ending its
+ *          bucket. Caller holds mutex.
+ */
+static entry_t **index_find(const char *key, size_t keylen) {
+    entry_t **pp = &buckets[hash(key, keylen, 2166136261u) % DISK_BUCKETS];
+
+    for (; *pp; pp = &(*pp)->next) {
+        if ((*pp)->keylen == keylen && !memcmp((*pp)->key, key, keylen)) {
+            break;
+        }
+    }
+    return pp;
+}
+
+/*
+ * index_put - Point key at a record, replacing an older one. verified
+ *          says whether its data is known to match datacheck.
+ *          Caller holds mutex.
+ */
+static void index_put(const char *key, size_t keylen, segment_t *sp,
+                      size_t off, size_t len, size_t hdrend,
+                      uint32_t datacheck, int verified) {
+    entry_t **pp = index_find(key, keylen), *ep;
+
+    if (!(ep = *pp)) {
+        ep = Malloc(sizeof(entry_t));
+        ep->key = Malloc(keylen);
+        memcpy(ep->key, key, keylen);
+        ep->keylen = keylen;
+        ep->next = NULL;
+        *pp = ep;
+    }
+    ep->seg = sp;
+    ep->off = off;
+    ep->len = len;
+    ep->hdrend = hdrend;
+    ep->datacheck = datacheck;
+    ep->verified = verified;
+}
+
+/*
+ * evict - Delete the oldest segments while over budget, never the one
+ *          being appended to. Caller holds mutex.
+ */
+static void evict(void) {
+    char path[MAXLINE];
+    segment_t *sp;
+    entry_t **pp, *ep;
+    int i;
+
+    while (total_bytes > max_bytes && oldest && oldest != active) {
+        sp = oldest;
+        oldest = sp->next;
+        total_bytes -= sp->size;
+
+        for (i = 0; i < DISK_BUCKETS; i++) {
+            for (pp = &buckets[i]; (ep = *pp); ) {
+                if (ep->seg == sp) {
+                    *pp = ep->next;
+                    Free(ep->key);
+                    Free(ep);
+                }
+                else {
+                    pp = &ep->next;
+                }
+            }
+        }
+
+        snprintf(path, MAXLINE, "%s/seg-%08u", cache_dir, sp->id);
+        unlink(path);
+        sp->dead = 1;
+        sp->refs++;
+        put_segment(sp);
+    }
+}
+
+/*
+ * put_segment - Drop a reference; a deleted segment is unmapped with
+ *          its last one. Caller holds mutex.
+ */
+static void put_segment(segment_t *sp) {
+    if (--sp->refs > 0 || !sp->dead) {
+        return;
+    }
+    munmap(sp->map, DISK_SEGMENT_SIZE);
+    Close(sp->fd);
+    Free(sp);
+}
+
+static int compare_ids(const void *a, const void *b) {
+    unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+    return x < y ? -1 : x > y;
+}
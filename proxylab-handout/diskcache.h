@@ -0,0 +1,30 @@
+/*
+ * diskcache.h - Persistent response cache on local disk for the proxy.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ */
+#ifndef __DISKCACHE_H__
+#define __DISKCACHE_H__
+
+#include "csapp.h"
+
+#define DISK_SEGMENT_SIZE (64 * 1024 * 1024)   /* Bytes per segment file */
+#define DISK_CACHE_MAX 1024                    /* Default budget, in MB */
+#define DISK_BUCKETS 65536                     /* Index hash buckets */
+
+/* A stored response, pinned in memory until disk_cache_release */
+typedef struct {
+    void *segment;
+    char *data;         /* Response, mapped from its segment */
+    size_t len;
+    size_t hdrend;      /* Where our own headers go */
+} disk_object_t;
+
+int disk_cache_init(const char *dir, size_t maxbytes);
+int disk_cache_find(const char *key, disk_object_t *op);
+void disk_cache_release(disk_object_t *op);
+void disk_cache_insert(const char *key, char *object, size_t len);
+
+#endif /* __DISKCACHE_H__ */
@@ -0,0 +1,797 @@
+/*
+ * event.c - Event-driven (epoll) mode of the proxy.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ * Each loop thread owns a listening socket bound with SO_REUSEPORT, so
+ * the kernel spreads new connections across the loops, and an epoll
+ * instance watching every client and server socket it accepted. All
+ * sockets are non-blocking. A connection is a small state machine:
+ *
+ *   READ_REQUEST -> CONNECTING -> SEND_REQUEST -> READ_HEADER -> RELAY
+ *        |                                                         |
+ *        +-> SEND_CACHED (cache hit or error reply) -> next request <+
+ *
+ * Client connections are persistent under the same rules as in the
+ * threaded mode (request_keepalive): after a response the connection
+ * goes back to READ_REQUEST, where pipelined requests may already be
+ * buffered, or is closed. The server is asked for HTTP/1.0 and closes
+ * after each response. Its header is held until complete, to swap the
+ * hop-by-hop lines for our own Connection header; a body without a
+ * Content-Length ends with the server's connection, and so ends the
+ * client's too.
+ *
+ * During RELAY only one side is watched at a time: the server while the
+ * relay buffer is empty, the client while it still holds unsent bytes.
+ * A slow or idle client therefore costs its conn_t, about 28 KB, plus
+ * the copy of a cacheable response, grown as it streams through,
+ * instead of a whole thread and its stack.
+ *
+ */
+
+#include <sys/epoll.h>
+#include <netinet/tcp.h>
+#include "csapp.h"
+#include "request.h"
+#include "cache.h"
+#include "http.h"
+#include "stats.h"
+#include "event.h"
+
+#define MAXEVENTS 256   /* Events handled per epoll_wait */
+
+/* Connection states */
+typedef enum {
+    CONN_READ_REQUEST,  /* Reading request line and headers from client */
+    CONN_CONNECTING,    /* Waiting for a non-blocking connect to finish */
+    CONN_SEND_REQUEST,  /* Writing the request to the server */
+    CONN_READ_HEADER,   /* Reading the response header from the server */
+    CONN_RELAY,         /* Copying the response to the client */
+    CONN_SEND_CACHED,   /* Writing a cached object or error to client */
+    CONN_CLOSED         /* Waiting to be freed at the end of the batch */
+} conn_state_t;
+
+typedef struct conn conn_t;
+
+/* One socket of a connection, as registered with epoll */
+typedef struct {
+    int fd;
+    conn_t *conn;       /* NULL for the listening socket */
+} endpoint_t;
+
+/* Per-connection state */
+struct conn {
+    conn_state_t state;
+    endpoint_t client;
+    endpoint_t server;
+    rio_t rio;              /* Client bytes, pipelined requests included */
+    request_t request;      /* Parsed in place in rio's buffer */
+    int keepalive;          /* Client connection stays open afterwards */
+    int resume;             /* A response ended: look for the next request */
+    char buf[MAXBUF];       /* Response header, then relay buffer */
+    size_t buflen;          /* Bytes of the response header read so far */
+    long remaining;         /* Body bytes left, -1 means until EOF */
+    struct iovec out[REQ_MAXIOV];   /* Bytes being written */
+    int outpos, outcnt;     /* First unfinished entry, entries */
+    char key[MAXLINE];      /* Cache key, empty if not cacheable */
+    char *object;           /* Copy of the response, or a reply to send */
+    size_t objectlen, objectcap;
+    int copy;               /* Still copying the response for the cache */
+    unsigned long start;    /* stats_now() when the request was complete */
+    conn_t *next_dead;
+};
+
+/* Per-loop state */
+typedef struct {
+    int epfd;
+    endpoint_t listener;
+    conn_t *dead;           /* Connections closed in this batch */
+    char *hit;              /* MAX_OBJECT_SIZE bytes for cache_find */
+} loop_t;
+
+/* Connection headers sent to the client */
+static const char _keepAlive[] = "Connection: keep-alive\r\n";
+static const char _close[] = "Connection: close\r\n";
+
+/* Helpers */
+static void *event_loop(void *vargp);
+static int open_listenfd_reuseport(char *port);
+static int open_clientfd_nb(char *host, char *port, int *connected);
+static void set_interest(loop_t *lp, endpoint_t *ep, int op, unsigned int events);
+static void accept_all(loop_t *lp);
+static void handle(loop_t *lp, endpoint_t *ep, unsigned int events);
+static void read_request(loop_t *lp, conn_t *c);
+static void start_request(loop_t *lp, conn_t *c);
+static void send_request(loop_t *lp, conn_t *c);
+static void read_header(loop_t *lp, conn_t *c);
+static void relay(loop_t *lp, conn_t *c, endpoint_t *ep, unsigned int events);
+static void keep(conn_t *c, char *buf, size_t n);
+static void end_response(loop_t *lp, conn_t *c);
+static void next_request(loop_t *lp, conn_t *c);
+static void set_out(conn_t *c, char *buf, size_t len);
+static int flush_out(conn_t *c, int fd);
+static void reply(loop_t *lp, conn_t *c, char *msg, size_t len);
+static void reply_error(loop_t *lp, conn_t *c, int status);
+static void send_reply(loop_t *lp, conn_t *c);
+static void close_conn(loop_t *lp, conn_t *c);
+
+
+/*
+ * event_run - Start nloops epoll loops (one per core when 0) and serve
+ *          forever. The calling thread runs the last loop.
+ */
+void event_run(char *port, int nloops) {
+    pthread_t tid;
+    int i;
+
+    if (nloops <= 0) {
+        nloops = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (nloops <= 0) {
+        nloops = 1;
+    }
+
+    for (i = 0; i < nloops - 1; i++) {
+        Pthread_create(&tid, NULL, event_loop, port);
+    }
+    event_loop(port);
+    exit(0);
+}
+
+/*
+ * event_loop - Thread routine. Accept and serve connections on a private
+ *          listening socket and epoll instance.
+ */
+static void *event_loop(void *vargp) {
+    char *port = vargp;
+    struct epoll_event events[MAXEVENTS];
+    loop_t loop;
+    conn_t *c;
+    int i, n;
+
+    if ((loop.listener.fd = open_listenfd_reuseport(port)) < 0) {
+        printf("Invalid port %s\n", port);
+        exit(1);
+    }
+    loop.listener.conn = NULL;
+    loop.dead = NULL;
+    loop.hit = Malloc(MAX_OBJECT_SIZE);
+    if ((loop.epfd = epoll_create1(0)) < 0) {
+        unix_error("epoll_create1 error");
+    }
+    set_interest(&loop, &loop.listener, EPOLL_CTL_ADD, EPOLLIN);
+
+    while (1) {
+        if ((n = epoll_wait(loop.epfd, events, MAXEVENTS, -1)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            unix_error("epoll_wait error");
+        }
+        for (i = 0; i < n; i++) {
+            endpoint_t *ep = events[i].data.ptr;
+            if (ep == &loop.listener) {
+                accept_all(&loop);
+            }
+            else {
+                handle(&loop, ep, events[i].events);
+            }
+        }
+
+        /* Nothing in this batch can refer to these any more */
+        while ((c = loop.dead) != NULL) {
+            loop.dead = c->next_dead;
+            Free(c);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * open_listenfd_reuseport - Like open_listenfd, but non-blocking and with
+ *          SO_REUSEPORT so every loop can bind its own socket to port.
+ *          Returns -1 on error.
+ */
+static int open_listenfd_reuseport(char *port) {
+    struct addrinfo hints, *listp, *p;
+    int listenfd, optval = 1;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG | AI_NUMERICSERV;
+    if (getaddrinfo(NULL, port, &hints, &listp) != 0) {
+        return -1;
+    }
+
+    for (p = listp; p; p = p->ai_next) {
+        if ((listenfd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK,
+                               p->ai_protocol)) < 0) {
+            continue;
+        }
+        Setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR,
+                   (const void *)&optval, sizeof(int));
+        Setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+                   (const void *)&optval, sizeof(int));
+        if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0) {
+            break;
+        }
+        Close(listenfd);
+    }
+
+    Freeaddrinfo(listp);
+    if (!p) {
+        return -1;
+    }
+    if (listen(listenfd, LISTENQ) < 0) {
+        Close(listenfd);
+        return -1;
+    }
+    return listenfd;
+}
+
+/*
+ * open_clientfd_nb - Start a non-blocking connect to host:port. Sets
+ *          *connected when the connect already finished. Returns the
+ *          socket, or -1 on error. Names come from the DNS cache, so only
+ *          a cache miss blocks the loop on the resolver.
+ */
+static int open_clientfd_nb(char *host, char *port, int *connected) {
+    dns_addr_t addrs[DNS_MAX_ADDRS];
+    int fd, i, n;
+
+    n = dns_resolve(host, port, addrs, DNS_MAX_ADDRS);
+    for (i = 0; i < n; i++) {
+        if ((fd = socket(addrs[i].family, addrs[i].socktype | SOCK_NONBLOCK,
+                         addrs[i].protocol)) < 0) {
+            continue;
+        }
+        if (connect(fd, (SA *)&addrs[i].addr, addrs[i].addrlen) == 0) {
+            *connected = 1;
+            return fd;
+        }
+        if (errno == EINPROGRESS) {
+            *connected = 0;
+            return fd;
+        }
+        Close(fd);
+    }
+    return -1;
+}
+
+/*
+ * set_interest - Add or modify the epoll registration of an endpoint.
+ */
+static void set_interest(loop_t *lp, endpoint_t *ep, int op, unsigned int events) {
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.ptr = ep;
+    if (epoll_ctl(lp->epfd, op, ep->fd, &ev) < 0) {
+        unix_error("epoll_ctl error");
+    }
+}
+
+/*
+ * accept_all - Accept every pending connection and start reading it.
+ */
+static void accept_all(loop_t *lp) {
+    conn_t *c;
+    int fd, optval = 1;
+
+    while ((fd = accept(lp->listener.fd, NULL, NULL)) >= 0) {
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(int));
+        c = Malloc(sizeof(conn_t));
+        c->state = CONN_READ_REQUEST;
+        c->client.fd = fd;
+        c->client.conn = c;
+        c->server.fd = -1;
+        c->server.conn = c;
+        rio_readinitb(&c->rio, fd);
+        c->keepalive = 0;
+        c->resume = 0;
+        c->buflen = 0;
+        c->remaining = 0;
+        c->outpos = c->outcnt = 0;
+        c->key[0] = '\0';
+        c->object = NULL;
+        c->objectlen = c->objectcap = 0;
+        c->copy = 0;
+        c->next_dead = NULL;
+        set_interest(lp, &c->client, EPOLL_CTL_ADD, EPOLLIN);
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        printf("Accept socket error\n");
+    }
+}
+
+/*
+ * handle - Dispatch one epoll event to the connection's state machine.
+ */
+static void handle(loop_t *lp, endpoint_t *ep, unsigned int events) {
+    conn_t *c = ep->conn;
+    int rc;
+
+    if (c->state == CONN_CLOSED) {
+        return;
+    }
+    if (events & EPOLLERR) {
+        if (c->state == CONN_CONNECTING) {
+            reply_error(lp, c, HTTP_BAD_GATEWAY);
+        }
+        else {
+            close_conn(lp, c);
+        }
+        return;
+    }
+
+    switch (c->state) {
+        case CONN_READ_REQUEST:
+            read_request(lp, c);
+            break;
+        case CONN_CONNECTING:
+        case CONN_SEND_REQUEST:
+            if (ep == &c->server) {
+                send_request(lp, c);
+            }
+            else {
+                close_conn(lp, c);  /* Client hung up */
+            }
+            break;
+        case CONN_READ_HEADER:
+            if (ep == &c->server) {
+                read_header(lp, c);
+            }
+            else {
+                close_conn(lp, c);  /* Client hung up */
+            }
+            break;
+        case CONN_RELAY:
+            relay(lp, c, ep, events);
+            break;
+        case CONN_SEND_CACHED:
+            if ((rc = flush_out(c, c->client.fd)) < 0) {
+                close_conn(lp, c);
+            }
+            else if (rc > 0) {
+                next_request(lp, c);
+            }
+            break;
+        default:
+            break;
+    }
+
+    /* The next request may be buffered already. It is read here, not
+       from inside the response that just ended, as a pipeline can hold
+       many of them. */
+    while (c->state == CONN_READ_REQUEST && c->resume) {
+        c->resume = 0;
+        read_request(lp, c);
+    }
+}
+
+/*
+ * read_request - Read until the blank line that ends the request headers.
+ */
+static void read_request(loop_t *lp, conn_t *c) {
+    int rc;
+
+    if ((rc = request_read(&c->rio, &c->request)) == REQUEST_AGAIN) {
+        return;
+    }
+    if (rc == 0) {
+        close_conn(lp, c);      /* Client closed between requests */
+    }
+    else if (rc < 0) {
+        reply_error(lp, c, HTTP_BAD_REQUEST);
+    }
+    else {
+        start_request(lp, c);
+    }
+}
+
+/*
+ * start_request - Parse the complete request, then either answer it from
+ *          the cache or start connecting to the server.
+ */
+static void start_request(loop_t *lp, conn_t *c) {
+    request_t *rp = &c->request;
+    char host[MAXLINE], port[MAXLINE], uri[MAXLINE];
+    size_t objectlen;
+    int connected, hit;
+    unsigned long t;
+
+    c->start = stats_now();
+    stats_count(COUNT_REQUESTS);
+    c->keepalive = request_keepalive(rp);
+    c->key[0] = '\0';
+    if (!span_eq(rp, rp->method, "GET")) {
+        reply_error(lp, c, HTTP_NOT_IMPLEMENTED);
+        return;
+    }
+    if (!rp->host.len && span_copy(rp, rp->path, uri, MAXLINE) == 0 &&
+        !strncmp(uri, STATS_PATH, strlen(STATS_PATH))) {
+        c->object = Malloc(STATS_MAXLEN + MAXLINE);
+        objectlen = stats_response(c->object, STATS_MAXLEN + MAXLINE, uri,
+                                   c->keepalive);
+        reply(lp, c, c->object, objectlen);
+        return;
+    }
+    if (!rp->host.len || span_copy(rp, rp->host, host, MAXLINE) < 0 ||
+        span_copy(rp, rp->port, port, MAXLINE) < 0) {
+        reply_error(lp, c, HTTP_BAD_REQUEST);
+        return;
+    }
+    if (!rp->port.len) {
+        strcpy(port, "80");
+    }
+
+    /* Serve from cache if we can. Range requests are relayed without it:
+       the raw reply cannot be cut down, and a 206 must not be cached.
+       A hit is looked up in the loop's buffer and kept in one its size;
+       c->buf holds any Content-Length line added to it. */
+    if (rp->rangehdr < 0 && snprintf(c->key, MAXLINE, "%s:%s%.*s", host, port,
+                 (int)rp->path.len, SPAN_PTR(rp, rp->path)) < MAXLINE) {
+        t = stats_now();
+        hit = cache_find(c->key, lp->hit, &objectlen);
+        stats_time(STAGE_CACHE, t);
+        if (hit) {
+            stats_count(COUNT_CACHE_HITS);
+            c->object = Malloc(objectlen);
+            memcpy(c->object, lp->hit, objectlen);
+            c->outcnt = http_object_iov(c->object, objectlen, c->buf,
+                                        c->keepalive, c->out);
+            c->outpos = 0;
+            send_reply(lp, c);
+            return;
+        }
+        stats_count(COUNT_CACHE_MISSES);
+    }
+    else {
+        c->key[0] = '\0';
+    }
+
+    if ((c->server.fd = open_clientfd_nb(host, port, &connected)) < 0) {
+        stats_count(COUNT_ERRORS);
+        reply_error(lp, c, HTTP_BAD_GATEWAY);
+        return;
+    }
+    stats_count(COUNT_UPSTREAM_NEW);
+    set_interest(lp, &c->client, EPOLL_CTL_MOD, 0);
+    set_interest(lp, &c->server, EPOLL_CTL_ADD, EPOLLOUT);
+    /* The request goes out gathered from rio's buffer, which is not read
+       again until the response is done. It asks for HTTP/1.0, since the
+       body is passed on untouched and a chunked one could reach an
+       HTTP/1.0 client. */
+    c->outcnt = request_iov(rp, c->out, 0);
+    c->outpos = 0;
+    c->state = connected ? CONN_SEND_REQUEST : CONN_CONNECTING;
+}
+
+/*
+ * send_request - Finish the connect if needed and write the request.
+ */
+static void send_request(loop_t *lp, conn_t *c) {
+    int err = 0, rc;
+    socklen_t len = sizeof(err);
+
+    if (c->state == CONN_CONNECTING) {
+        if (getsockopt(c->server.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+            reply_error(lp, c, HTTP_BAD_GATEWAY);
+            return;
+        }
+        c->state = CONN_SEND_REQUEST;
+    }
+
+    if ((rc = flush_out(c, c->server.fd)) < 0) {
+        close_conn(lp, c);
+    }
+    else if (rc > 0) {
+        c->state = CONN_READ_HEADER;
+        c->buflen = 0;
+        set_interest(lp, &c->server, EPOLL_CTL_MOD, EPOLLIN);
+    }
+}
+
+/*
+ * read_header - Read the response header, then send it on with our own
+ *          Connection header, followed by the body bytes read with it.
+ */
+static void read_header(loop_t *lp, conn_t *c) {
+    ssize_t n, hdrend;
+    long length;
+
+    while (1) {
+        n = read(c->server.fd, c->buf + c->buflen, MAXBUF - c->buflen);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (n > 0) {
+            c->buflen += n;
+            if ((hdrend = http_header_strip(c->buf, &c->buflen, &length)) >= 0) {
+                break;
+            }
+        }
+        /* Server failed, closed, or sent a header too large to hold */
+        if (n <= 0 || c->buflen == MAXBUF) {
+            stats_count(COUNT_ERRORS);
+            reply_error(lp, c, HTTP_BAD_GATEWAY);
+            return;
+        }
+    }
+
+    /* Body bytes beyond Content-Length mean the server is out of step;
+       they are dropped. A body that ends at EOF ends the client's
+       connection as well. */
+    n = c->buflen - hdrend - 2;
+    if (length >= 0 && n > length) {
+        c->buflen -= n - length;
+        n = length;
+    }
+    c->remaining = length < 0 ? -1 : length - n;
+    if (length < 0) {
+        c->keepalive = 0;
+    }
+
+    /* Copy a response that may fit for the cache: at once when its size
+       is known, growing as it arrives when not */
+    c->copy = c->key[0] && (length < 0 || hdrend + 2 + length <= MAX_OBJECT_SIZE);
+    if (c->copy && length >= 0) {
+        c->objectcap = hdrend + 2 + length;
+        c->object = Malloc(c->objectcap);
+    }
+    keep(c, c->buf, c->buflen);
+
+    c->out[0].iov_base = c->buf;
+    c->out[0].iov_len = hdrend;
+    c->out[1].iov_base = (void *)(c->keepalive ? _keepAlive : _close);
+    c->out[1].iov_len = c->keepalive ? sizeof(_keepAlive) - 1 : sizeof(_close) - 1;
+    c->out[2].iov_base = c->buf + hdrend;
+    c->out[2].iov_len = c->buflen - hdrend;
+    c->outpos = 0;
+    c->outcnt = 3;
+    c->state = CONN_RELAY;
+    relay(lp, c, &c->server, 0);
+}
+
+/*
+ * relay - Write what is pending to the client, then move the rest of
+ *          the body from server to client, one buffer at a time.
+ */
+static void relay(loop_t *lp, conn_t *c, endpoint_t *ep, unsigned int events) {
+    int parked = ep == &c->client;  /* The server waited for the client */
+    ssize_t n;
+    int rc;
+
+    if (parked && !(events & EPOLLOUT)) {
+        close_conn(lp, c);
+        return;
+    }
+
+    while (1) {
+        if ((rc = flush_out(c, c->client.fd)) < 0) {
+            close_conn(lp, c);
+            return;
+        }
+        if (rc == 0) {
+            /* Client is slow: park the server until it catches up */
+            if (!parked) {
+                set_interest(lp, &c->server, EPOLL_CTL_MOD, 0);
+                set_interest(lp, &c->client, EPOLL_CTL_MOD, EPOLLOUT);
+            }
+            return;
+        }
+        if (c->remaining == 0) {
+            end_response(lp, c);
+            return;
+        }
+        if (parked) {
+            /* Client drained: resume reading the server */
+            set_interest(lp, &c->client, EPOLL_CTL_MOD, 0);
+            set_interest(lp, &c->server, EPOLL_CTL_MOD, EPOLLIN);
+            parked = 0;
+        }
+
+        n = read(c->server.fd, c->buf, c->remaining > 0 &&
+                 c->remaining < MAXBUF ? c->remaining : MAXBUF);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (n == 0 && c->remaining < 0) {
+            end_response(lp, c);    /* EOF ends this body */
+            return;
+        }
+        if (n <= 0) {
+            /* Server failed or cut the body short */
+            stats_count(COUNT_ERRORS);
+            close_conn(lp, c);
+            return;
+        }
+        keep(c, c->buf, n);
+        if (c->remaining > 0) {
+            c->remaining -= n;
+        }
+        set_out(c, c->buf, n);
+    }
+}
+
+/*
+ * keep - Add n response bytes to the copy for the cache, growing it as
+ *          needed, or give the copy up once it is too large to cache.
+ */
+static void keep(conn_t *c, char *buf, size_t n) {
+    size_t cap;
+
+    if (!c->copy) {
+        return;
+    }
+    if (c->objectlen + n > MAX_OBJECT_SIZE) {
+        if (c->object) {
+            Free(c->object);
+        }
+        c->object = NULL;
+        c->objectlen = c->objectcap = 0;
+        c->copy = 0;
+        return;
+    }
+    if (c->objectlen + n > c->objectcap) {
+        for (cap = c->objectcap ? c->objectcap : MAXBUF;
+             cap < c->objectlen + n; cap *= 2)
+            ;
+        c->objectcap = cap < MAX_OBJECT_SIZE ? cap : MAX_OBJECT_SIZE;
+        c->object = Realloc(c->object, c->objectcap);
+    }
+    memcpy(c->object + c->objectlen, buf, n);
+    c->objectlen += n;
+}
+
+/*
+ * end_response - The whole response reached the client. Cache a copy
+ *          of it if it is a complete 200, then go on to the next request.
+ */
+static void end_response(loop_t *lp, conn_t *c) {
+    if (c->copy && http_object_complete(c->object, c->objectlen)) {
+        cache_insert(c->key, c->object, c->objectlen);
+    }
+    stats_time(STAGE_TOTAL, c->start);
+    next_request(lp, c);
+}
+
+/*
+ * next_request - Done with a response: close the server connection, and
+ *          the client's too unless it stays open for another request.
+ */
+static void next_request(loop_t *lp, conn_t *c) {
+    if (!c->keepalive) {
+        close_conn(lp, c);
+        return;
+    }
+    if (c->server.fd >= 0) {
+        Close(c->server.fd);
+        c->server.fd = -1;
+    }
+    if (c->object) {
+        Free(c->object);
+        c->object = NULL;
+    }
+    c->objectlen = c->objectcap = 0;
+    c->copy = 0;
+    c->outpos = c->outcnt = 0;
+    c->state = CONN_READ_REQUEST;
+    c->resume = 1;
+    set_interest(lp, &c->client, EPOLL_CTL_MOD, EPOLLIN);
+}
+
+/*
+ * set_out - Make buf the only bytes to write
+ */
+static void set_out(conn_t *c, char *buf, size_t len) {
+    c->out[0].iov_base = buf;
+    c->out[0].iov_len = len;
+    c->outpos = 0;
+    c->outcnt = 1;
+}
+
+/*
+ * flush_out - Write pending bytes to fd, all entries at once. Returns 1
+ *          when everything was written, 0 if the socket would block, -1
+ *          on error.
+ */
+static int flush_out(conn_t *c, int fd) {
+    struct msghdr msg;
+    struct iovec *iov;
+    ssize_t n;
+
+    memset(&msg, 0, sizeof(msg));
+    while (c->outpos < c->outcnt) {
+        msg.msg_iov = &c->out[c->outpos];
+        msg.msg_iovlen = c->outcnt - c->outpos;
+        n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+
+        /* Skip the entries written, and the written part of the next */
+        while (c->outpos < c->outcnt && n >= c->out[c->outpos].iov_len) {
+            n -= c->out[c->outpos++].iov_len;
+        }
+        if (n > 0) {
+            iov = &c->out[c->outpos];
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 1;
+}
+
+/*
+ * reply - Send msg to the client, which must stay valid until then.
+ */
+static void reply(loop_t *lp, conn_t *c, char *msg, size_t len) {
+    set_out(c, msg, len);
+    send_reply(lp, c);
+}
+
+/*
+ * reply_error - Send the canned response for an error status and close
+ *          the connection afterwards.
+ */
+static void reply_error(loop_t *lp, conn_t *c, int status) {
+    c->keepalive = 0;
+    http_error_iov(status, c->out);
+    c->outpos = 0;
+    c->outcnt = HTTP_ERROR_IOV;
+    send_reply(lp, c);
+}
+
+/*
+ * send_reply - Write c->out to the client instead of asking the server.
+ */
+static void send_reply(loop_t *lp, conn_t *c) {
+    int rc;
+
+    if (c->server.fd >= 0) {
+        Close(c->server.fd);
+        c->server.fd = -1;
+    }
+    c->state = CONN_SEND_CACHED;
+    if ((rc = flush_out(c, c->client.fd)) < 0) {
+        close_conn(lp, c);
+    }
+    else if (rc > 0) {
+        next_request(lp, c);
+    }
+    else {
+        set_interest(lp, &c->client, EPOLL_CTL_MOD, EPOLLOUT);
+    }
+}
+
+/*
+ * close_conn - Close both sockets and queue the connection to be freed
+ *          once the current batch of events is done.
+ */
+static void close_conn(loop_t *lp, conn_t *c) {
+    Close(c->client.fd);
+    if (c->server.fd >= 0) {
+        Close(c->server.fd);
+    }
+    if (c->object) {
+        Free(c->object);
+    }
+    c->state = CONN_CLOSED;
+    c->next_dead = lp->dead;
+    lp->dead = c;
+}
@@ -0,0 +1,14 @@
+/*
+ * event.h - Event-driven (epoll) mode of the proxy.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ */
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+/* Run nloops epoll loops on port (0 means one per core). Never returns. */
+void event_run(char *port, int nloops);
+
+#endif /* __EVENT_H__ */
@@ -0,0 +1,337 @@
+/*
+ * flight.c - Single-flight fetches: concurrent misses on one object share
+ *            a single server request.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ * The first request to miss the cache on a key becomes the flight's
+ * leader and fetches the object as usual; requests for the same key that
+ * arrive while it is in progress join as followers instead of asking the
+ * server again. The leader publishes the response header and then every
+ * body byte as it relays them, and followers stream the bytes to their
+ * own clients as they arrive, each at its own pace.
+ *
+ * Body bytes are kept in a list of chunks. A flight accepts followers
+ * only for its first FLIGHT_JOIN_MAX bytes, since a newcomer needs the
+ * response from its start; after that it leaves the table and chunks are
+ * freed as soon as every follower has read past them, so a large object
+ * does not stay in memory. One semaphore guards the table; each flight
+ * has its own lock and condition variable, held only for bookkeeping
+ * and never while writing to a socket.
+ *
+ */
+
+#include "flight.h"
+
+/* Body bytes [start, start + len) */
+struct flight_chunk {
+    flight_chunk_t *next;
+    size_t start;
+    size_t len;
+    char data[FLIGHT_CHUNK];
+};
+
+struct flight {
+    char *key;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /* Signaled when anything is published */
+    int refs;                   /* Leader until flight_end, plus readers */
+    int joinable;               /* Still in the table */
+    int done, ok;               /* Set by flight_end */
+    char *header;               /* NULL until published */
+    size_t headerlen;
+    int delimited;              /* The header tells where the body ends */
+    flight_chunk_t *first, *tail;
+    size_t total;               /* Body bytes published */
+    flight_reader_t *readers;
+    struct flight *next;
+};
+
+/* Flights that can still be joined */
+static flight_t *flights = NULL;
+static sem_t mutex;
+
+/* Helpers */
+static void unpublish(flight_t *fp);
+static void trim(flight_t *fp);
+static void release(flight_t *fp);
+
+
+/*
+ * flight_init - Must run before any other call.
+ */
+void flight_init(void) {
+    flights = NULL;
+    Sem_init(&mutex, 0, 1);
+}
+
+/*
+ * flight_join - Join the flight fetching key, or start one. A follower
+ *          is registered as reader rp and must call flight_leave; a
+ *          leader must call flight_end. *fpp is set to the flight.
+ *
+ *  Return FLIGHT_LEADER or FLIGHT_FOLLOWER.
+ */
+int flight_join(const char *key, flight_t **fpp, flight_reader_t *rp) {
+    flight_t *fp;
+
+    P(&mutex);
+    for (fp = flights; fp; fp = fp->next) {
+        if (!strcmp(fp->key, key)) {
+            break;
+        }
+    }
+    if (fp) {
+        pthread_mutex_lock(&fp->lock);
+        fp->refs++;
+        rp->flight = fp;
+        rp->chunk = NULL;
+        rp->pos = rp->pending = 0;
+        rp->next = fp->readers;
+        fp->readers = rp;
+        pthread_mutex_unlock(&fp->lock);
+        V(&mutex);
+        *fpp = fp;
+        return FLIGHT_FOLLOWER;
+    }
+
+    fp = Calloc(1, sizeof(flight_t));
+    fp->key = Malloc(strlen(key) + 1);
+    strcpy(fp->key, key);
+    pthread_mutex_init(&fp->lock, NULL);
+    pthread_cond_init(&fp->cond, NULL);
+    fp->refs = 1;
+    fp->joinable = 1;
+    fp->next = flights;
+    flights = fp;
+    V(&mutex);
+    *fpp = fp;
+    return FLIGHT_LEADER;
+}
+
+/*
+ * flight_header - Publish the response header (without its blank line).
+ *          delimited says whether the body's end is known from it.
+ */
+void flight_header(flight_t *fp, const char *hdr, size_t len, int delimited) {
+    char *copy = Malloc(len);
+
+    memcpy(copy, hdr, len);
+    pthread_mutex_lock(&fp->lock);
+    fp->header = copy;
+    fp->headerlen = len;
+    fp->delimited = delimited;
+    pthread_cond_broadcast(&fp->cond);
+    pthread_mutex_unlock(&fp->lock);
+}
+
+/*
+ * flight_append - Publish n more body bytes.
+ *
+ *  Return 0 once nobody needs them any more (the flight can no longer be
+ *  joined and has no readers), 1 otherwise.
+ */
+int flight_append(flight_t *fp, const char *buf, size_t n) {
+    flight_chunk_t *cp;
+    size_t k;
+
+    if (fp->joinable && fp->total + n > FLIGHT_JOIN_MAX) {
+        unpublish(fp);
+    }
+
+    pthread_mutex_lock(&fp->lock);
+    if (!fp->joinable && !fp->readers) {
+        pthread_mutex_unlock(&fp->lock);
+        return 0;
+    }
+    while (n > 0) {
+        if (!fp->tail || fp->tail->len == FLIGHT_CHUNK) {
+            cp = Malloc(sizeof(flight_chunk_t));
+            cp->next = NULL;
+            cp->start = fp->total;
+            cp->len = 0;
+            if (fp->tail) {
+                fp->tail->next = cp;
+            }
+            else {
+                fp->first = cp;
+            }
+            fp->tail = cp;
+        }
+        cp = fp->tail;
+        k = FLIGHT_CHUNK - cp->len < n ? FLIGHT_CHUNK - cp->len : n;
+        memcpy(cp->data + cp->len, buf, k);
+        cp->len += k;
+        fp->total += k;
+        buf += k;
+        n -= k;
+    }
+    pthread_cond_broadcast(&fp->cond);
+    pthread_mutex_unlock(&fp->lock);
+    return 1;
+}
+
+/*
+ * flight_end - The leader is done: ok if the whole response was
+ *          published. Followers still reading finish on their own.
+ */
+void flight_end(flight_t *fp, int ok) {
+    unpublish(fp);
+    pthread_mutex_lock(&fp->lock);
+    fp->done = 1;
+    fp->ok = ok;
+    pthread_cond_broadcast(&fp->cond);
+    pthread_mutex_unlock(&fp->lock);
+    release(fp);
+}
+
+/*
+ * flight_wait_header - Wait for the leader's response header. It stays
+ *          valid until flight_leave.
+ *
+ *  Return 0, or -1 if the flight ended without one (nothing to relay;
+ *  the follower should fetch the object itself).
+ */
+int flight_wait_header(flight_reader_t *rp, char **hdrp, size_t *lenp,
+                       int *delimitedp) {
+    flight_t *fp = rp->flight;
+    int rc = -1;
+
+    pthread_mutex_lock(&fp->lock);
+    while (!fp->header && !fp->done) {
+        pthread_cond_wait(&fp->cond, &fp->lock);
+    }
+    if (fp->header) {
+        *hdrp = fp->header;
+        *lenp = fp->headerlen;
+        *delimitedp = fp->delimited;
+        rc = 0;
+    }
+    pthread_mutex_unlock(&fp->lock);
+    return rc;
+}
+
+/*
+ * flight_read - Wait for body bytes past the ones *bufp pointed to last
+ *          time and point *bufp at them. They stay valid until the next
+ *          call.
+ *
+ *  Return the number of bytes, 0 at the end of a complete response, -1
+ *  if the leader failed part way through.
+ */
+ssize_t flight_read(flight_reader_t *rp, char **bufp) {
+    flight_t *fp = rp->flight;
+    flight_chunk_t *cp;
+    ssize_t n;
+
+    pthread_mutex_lock(&fp->lock);
+    rp->pos += rp->pending;
+    rp->pending = 0;
+    trim(fp);
+    while (rp->pos == fp->total && !fp->done) {
+        pthread_cond_wait(&fp->cond, &fp->lock);
+    }
+    if (rp->pos < fp->total) {
+        for (cp = rp->chunk ? rp->chunk : fp->first;
+             rp->pos >= cp->start + cp->len; cp = cp->next)
+            ;
+        rp->chunk = cp;
+        n = rp->pending = cp->start + cp->len - rp->pos;
+        *bufp = cp->data + (rp->pos - cp->start);
+    }
+    else {
+        n = fp->ok ? 0 : -1;
+    }
+    pthread_mutex_unlock(&fp->lock);
+    return n;
+}
+
+/*
+ * flight_leave - Stop following the flight.
+ */
+void flight_leave(flight_reader_t *rp) {
+    flight_t *fp = rp->flight;
+    flight_reader_t **pp;
+
+    pthread_mutex_lock(&fp->lock);
+    for (pp = &fp->readers; *pp != rp; pp = &(*pp)->next)
+        ;
+    *pp = rp->next;
+    trim(fp);
+    pthread_mutex_unlock(&fp->lock);
+    release(fp);
+}
+
+
+/*
+ * unpublish - Take the flight out of the table so nobody else joins it.
+ *          Only the leader calls this.
+ */
+static void unpublish(flight_t *fp) {
+    flight_t **pp;
+
+    P(&mutex);
+    if (fp->joinable) {
+        for (pp = &flights; *pp != fp; pp = &(*pp)->next)
+            ;
+        *pp = fp->next;
+        pthread_mutex_lock(&fp->lock);
+        fp->joinable = 0;
+        pthread_mutex_unlock(&fp->lock);
+    }
+    V(&mutex);
+}
+
+/*
+ * trim - Free the chunks every reader is done with, once nobody new can
+ *          join. A chunk is kept while a reader's position is in it or
+ *          right at its end, so reader chunk pointers stay valid, and
+ *          the tail is kept for the leader. Called with fp->lock held.
+ */
+static void trim(flight_t *fp) {
+    flight_reader_t *rp;
+    flight_chunk_t *cp;
+    size_t min = fp->total;
+
+    if (fp->joinable) {
+        return;
+    }
+    for (rp = fp->readers; rp; rp = rp->next) {
+        if (rp->pos < min) {
+            min = rp->pos;
+        }
+    }
+    while (fp->first != fp->tail && fp->first->start + fp->first->len < min) {
+        cp = fp->first;
+        fp->first = cp->next;
+        Free(cp);
+    }
+}
+
+/*
+ * release - Drop one reference, freeing the flight with the last one.
+ */
+static void release(flight_t *fp) {
+    flight_chunk_t *cp;
+    int last;
+
+    pthread_mutex_lock(&fp->lock);
+    last = --fp->refs == 0;
+    pthread_mutex_unlock(&fp->lock);
+    if (!last) {
+        return;
+    }
+
+    while ((cp = fp->first)) {
+        fp->first = cp->next;
+        Free(cp);
+    }
+    if (fp->header) {
+        Free(fp->header);
+    }
+    pthread_mutex_destroy(&fp->lock);
+    pthread_cond_destroy(&fp->cond);
+    Free(fp->key);
+    Free(fp);
+}
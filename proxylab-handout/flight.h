@@ -0,0 +1,47 @@
+/*
+ * flight.h - Single-flight fetches: concurrent misses on one object share
+ *            a single server request.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ */
+#ifndef __FLIGHT_H__
+#define __FLIGHT_H__
+
+#include "csapp.h"
+
+#define FLIGHT_CHUNK (64 * 1024)        /* Bytes per buffer chunk */
+#define FLIGHT_JOIN_MAX (1024 * 1024)   /* Joining stops past this many */
+
+/* flight_join return values */
+#define FLIGHT_LEADER   1       /* Fetch the object and publish it */
+#define FLIGHT_FOLLOWER 0       /* Read what the leader publishes */
+
+typedef struct flight flight_t;
+typedef struct flight_chunk flight_chunk_t;
+
+/* A follower's position in a flight */
+typedef struct flight_reader {
+    flight_t *flight;
+    flight_chunk_t *chunk;      /* Chunk holding pos, NULL before the first */
+    size_t pos;                 /* Body bytes consumed */
+    size_t pending;             /* Handed out by the last flight_read */
+    struct flight_reader *next;
+} flight_reader_t;
+
+void flight_init(void);
+int flight_join(const char *key, flight_t **fpp, flight_reader_t *rp);
+
+/* Leader */
+void flight_header(flight_t *fp, const char *hdr, size_t len, int delimited);
+int flight_append(flight_t *fp, const char *buf, size_t n);
+void flight_end(flight_t *fp, int ok);
+
+/* Followers */
+int flight_wait_header(flight_reader_t *rp, char **hdrp, size_t *lenp,
+                       int *delimitedp);
+ssize_t flight_read(flight_reader_t *rp, char **bufp);
+void flight_leave(flight_reader_t *rp);
+
+#endif /* __FLIGHT_H__ */
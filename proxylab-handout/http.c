@@ -0,0 +1,1038 @@
+/*
+ * http.c - HTTP response handling for the proxy.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ * The response header is read line by line and forwarded in one write.
+ * The body is binary data, so it is relayed in RELAY_CHUNK pieces,
+ * stopping after Content-Length bytes when the server sent one. A
+ * chunked body (servers may send one since the proxy asks for HTTP/1.1)
+ * is decoded as it streams through, one chunk piece at a time, so memory
+ * stays bounded whatever its size. While
+ * the caller still wants a copy of the response (for the cache) the
+ * body goes through a user buffer; once no copy is needed, Linux moves
+ * it socket -> pipe -> socket with splice() and never touches it.
+ *
+ * A response fetched for a flight (see flight.c) is also published to
+ * the requests following it, which relay it with http_relay_flight.
+ *
+ * Whatever framing the server used, a body whose length is not known up
+ * front is sent chunked again to HTTP/1.1 clients, so their connection
+ * can stay open, and as is, ending with the connection, to HTTP/1.0
+ * ones. Cached copies and what followers read hold the decoded body.
+ *
+ * A server connection may be reused only when the body's end was known
+ * (from Content-Length or the last chunk) and fully read, and the server
+ * agreed to keep the connection open (explicitly for HTTP/1.0, by
+ * default for HTTP/1.1).
+ *
+ * Connection, Proxy-Connection, Keep-Alive and Transfer-Encoding describe
+ * a single hop, so they are dropped from the response and the proxy
+ * writes its own for the client. Cached copies carry none, which lets
+ * the same object be served on persistent and closing connections.
+ *
+ */
+
+#include "csapp.h"
+#include "http.h"
+#include "stats.h"
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+/* splice() flags, from <fcntl.h> with _GNU_SOURCE */
+#define RELAY_SPLICE_MOVE 1
+#define RELAY_SPLICE_MORE 4
+
+/* Where relayed bytes go */
+typedef struct {
+    int fd;             /* Client descriptor, -1 once it failed */
+    rio_wbuf_t out;     /* Buffered writes to fd */
+    flight_t *flight;   /* Followers to publish to, NULL if none */
+    int chunked;        /* Frame what the client gets as chunks */
+    char *copy;         /* Copy of everything sent, NULL once abandoned */
+    size_t copycap;
+    size_t copylen;
+} sink_t;
+
+/* Connection headers sent to the client */
+static const char _keepAlive[] = "Connection: keep-alive\r\n";
+static const char _close[] = "Connection: close\r\n";
+
+/* Chunked framing for the client */
+static const char _chunked[] = "Transfer-Encoding: chunked\r\n";
+static const char _lastChunk[] = "0\r\n\r\n";
+
+/* Status lines (after the version) for answering Range requests */
+static const char _partial[] = " 206 Partial Content\r\n";
+static const char _unsatisfiable[] = " 416 Range Not Satisfiable\r\n";
+
+/* Canned error responses; the last one is for any other status */
+static const char _errorHeader[] = "Content-Type: text/plain\r\n"
+                                   "Connection: close\r\n\r\n";
+static const struct {
+    int status;
+    const char *line;
+    const char *body;
+} errors[] = {
+    {400, "HTTP/1.0 400 Bad Request\r\n", "Bad request\n"},
+    {501, "HTTP/1.0 501 Not Implemented\r\n", "Method not supported\n"},
+    {502, "HTTP/1.0 502 Bad Gateway\r\n", "Server unreachable\n"},
+    {0, "HTTP/1.0 500 Internal Server Error\r\n", "Internal error\n"}
+};
+
+/* Per-thread pipe for splice(), created on first use */
+static __thread int relay_pipe[2] = {-1, -1};
+
+/* Helpers */
+static int has_token(const char *value, const char *token);
+static char *header_end(char *buf, size_t len);
+static int object_iov(char *object, size_t len, size_t hdrend, char *length,
+                      int clientkeepalive, struct iovec *iov);
+static int parse_range(const char *range, size_t size, size_t *firstp,
+                       size_t *lastp);
+static int write_chunk(int fd, char *buf, size_t n);
+static int sink_out(sink_t *sp, char *buf, size_t n);
+static int sink_write(sink_t *sp, char *buf, size_t n);
+static int sink_flush(sink_t *sp);
+static void sink_keep(sink_t *sp, char *buf, size_t n);
+static ssize_t relay_copy(int serverfd, sink_t *sp, size_t n);
+static ssize_t relay_splice(int serverfd, sink_t *sp, size_t n);
+static int relay_chunked(rio_t *rp, sink_t *sp);
+static int line_buffered(rio_t *rp);
+
+
+/*
+ * http_relay_response - Forward a whole response from serverriop to
+ *          clientfd. clientflags are HTTP_CLIENT_*: the client connection
+ *          stays open afterwards if it asked for that and the client can
+ *          tell where the body ends. If copy is not NULL, also store a
+ *          200 response there (without any hop-by-hop header, and with a
+ *          chunked body decoded) as long as it fits in copycap bytes. If
+ *          flight is not NULL, publish the response to its followers,
+ *          and keep reading it for them even if clientfd fails. The
+ *          outcome is described in *resultp.
+ *
+ *  Return HTTP_RELAY_OK on success, HTTP_RELAY_EMPTY if the server sent
+ *  nothing at all (nothing was written to the client either), and
+ *  HTTP_RELAY_ERROR on any other error. A response header over MAXBUF
+ *  is an error too, answered with 502 Bad Gateway.
+ */
+int http_relay_response(rio_t *serverriop, int clientfd, int clientflags,
+                        char *copy, size_t copycap, flight_t *flight,
+                        http_relay_t *resultp)
+{
+    char line[MAXLINE], hdr[MAXBUF], outbuf[RELAY_OUTBUF];
+    size_t hdrlen = 0;
+    long remaining = -1;    /* Body bytes left, -1 means until EOF */
+    int status = 0, keepalive = 0, bodyless = 0, chunked = 0;
+    int clientkeepalive;
+    ssize_t n, lengthpos = -1;
+    size_t chunk, lengthlen = 0;
+    sink_t sink;
+
+    sink.fd = clientfd;
+    rio_writeinitb(&sink.out, clientfd, outbuf, RELAY_OUTBUF);
+    sink.flight = NULL;
+    sink.chunked = 0;
+    sink.copy = copy;
+    sink.copycap = copycap;
+    sink.copylen = 0;
+    resultp->copied = 0;
+    resultp->copylen = 0;
+    resultp->keepalive = 0;
+    resultp->clientkeepalive = 0;
+    resultp->received = 0;
+
+    /* Status line */
+    n = rio_readlineb(serverriop, line, MAXLINE);
+    resultp->firstbyte = stats_now();
+    if (n <= 0) {
+        return n == 0 ? HTTP_RELAY_EMPTY : HTTP_RELAY_ERROR;
+    }
+    if (!strncmp(line, "HTTP/1.1", 8)) {
+        keepalive = 1;
+    }
+    sscanf(line, "%*s %d", &status);
+    if ((status >= 100 && status < 200) || status == 204 || status == 304) {
+        bodyless = 1;
+    }
+    if (status != 200) {
+        sink.copy = NULL;   /* Only whole 200 responses are cached */
+    }
+    memcpy(hdr, line, n);
+    hdrlen = n;
+
+    /* Headers, minus the hop-by-hop ones we answer ourselves */
+    while ((n = rio_readlineb(serverriop, line, MAXLINE)) > 0) {
+        if (!strcmp(line, "\r\n")) {
+            break;
+        }
+        if (!strncasecmp(line, "Content-Length:", 15)) {
+            remaining = atol(line + 15);
+            lengthpos = hdrlen;
+            lengthlen = n;
+        }
+        else if (!strncasecmp(line, "Transfer-Encoding:", 18) &&
+                 has_token(line + 18, "chunked")) {
+            chunked = 1;
+            continue;
+        }
+        else if (!strncasecmp(line, "Connection:", 11)) {
+            if (has_token(line + 11, "close")) {
+                keepalive = 0;
+            }
+            else if (has_token(line + 11, "keep-alive")) {
+                keepalive = 1;
+            }
+            continue;
+        }
+        else if (!strncasecmp(line, "Proxy-Connection:", 17) ||
+                 !strncasecmp(line, "Keep-Alive:", 11)) {
+            continue;
+        }
+        /* A header is framed as a whole, so one too big to hold is
+           refused rather than forwarded in pieces */
+        if (hdrlen + n > MAXBUF - sizeof(_chunked) - sizeof(_keepAlive) - 2) {
+            http_send_error(clientfd, HTTP_BAD_GATEWAY);
+            return HTTP_RELAY_ERROR;
+        }
+        memcpy(hdr + hdrlen, line, n);
+        hdrlen += n;
+    }
+    if (n < 0) {
+        return HTTP_RELAY_ERROR;
+    }
+
+    /* Chunked framing overrides Content-Length, which must not reach
+       the client alongside our own framing */
+    if (bodyless) {
+        remaining = 0;
+        chunked = 0;
+    }
+    else if (chunked) {
+        remaining = -1;
+        if (lengthpos >= 0) {
+            memmove(hdr + lengthpos, hdr + lengthpos + lengthlen,
+                    hdrlen - lengthpos - lengthlen);
+            hdrlen -= lengthlen;
+        }
+    }
+    if (n == 0 || (remaining < 0 && !chunked)) {
+        keepalive = 0;      /* Body ends at EOF */
+    }
+
+    /* A body of unknown length goes to an HTTP/1.1 client in chunks, so
+       its connection can stay open */
+    sink.chunked = n > 0 && remaining < 0 &&
+                   (clientflags & HTTP_CLIENT_CHUNKED);
+    clientkeepalive = (clientflags & HTTP_CLIENT_KEEPALIVE) && n > 0 &&
+                      (remaining >= 0 || sink.chunked);
+
+    /* The copy ends the header as the server did; the client also
+       learns how the body is framed and whether its connection stays
+       open. */
+    sink_keep(&sink, hdr, hdrlen);
+    sink_keep(&sink, "\r\n", 2);
+    if (flight) {
+        flight_header(flight, hdr, hdrlen, n > 0 && remaining >= 0);
+        sink.flight = flight;
+    }
+    hdrlen += sprintf(hdr + hdrlen, "%s%s\r\n", sink.chunked ? _chunked : "",
+                      clientkeepalive ? _keepAlive : _close);
+    if (rio_writeb(&sink.out, hdr, hdrlen) < 0) {
+        if (!sink.flight) {
+            return HTTP_RELAY_ERROR;
+        }
+        sink.fd = -1;
+    }
+
+    /* Known to be too large for the copy: don't bother */
+    if (sink.copy && remaining >= 0 && sink.copylen + remaining > copycap) {
+        sink.copy = NULL;
+    }
+
+    if (chunked) {
+        if (relay_chunked(serverriop, &sink) < 0) {
+            return HTTP_RELAY_ERROR;
+        }
+        remaining = 0;
+    }
+
+    /* Body bytes the header reads already buffered */
+    if (serverriop->rio_cnt > 0 && remaining != 0) {
+        chunk = serverriop->rio_cnt;
+        if (remaining >= 0 && chunk > remaining) {
+            chunk = remaining;
+        }
+        if (sink_write(&sink, serverriop->rio_bufptr, chunk) < 0) {
+            return HTTP_RELAY_ERROR;
+        }
+        serverriop->rio_bufptr += chunk;
+        serverriop->rio_cnt -= chunk;
+        if (remaining >= 0) {
+            remaining -= chunk;
+        }
+    }
+
+    /* The rest straight from the socket, after sending what is buffered
+       (in the best case the whole response, with one write) */
+    while (remaining != 0) {
+        if (sink_flush(&sink) < 0) {
+            return HTTP_RELAY_ERROR;
+        }
+        chunk = RELAY_CHUNK;
+        if (remaining >= 0 && chunk > remaining) {
+            chunk = remaining;
+        }
+        n = sink.copy || sink.flight || sink.chunked ? -1 :
+            relay_splice(serverriop->rio_fd, &sink, chunk);
+        if (n == -1) {
+            n = relay_copy(serverriop->rio_fd, &sink, chunk);
+        }
+        if (n < 0) {
+            return HTTP_RELAY_ERROR;
+        }
+        if (n == 0) {
+            if (remaining > 0) {
+                return HTTP_RELAY_ERROR;    /* Cut short */
+            }
+            keepalive = 0;  /* EOF */
+            break;
+        }
+        if (remaining >= 0) {
+            remaining -= n;
+        }
+    }
+
+    /* Leftover bytes mean the server is out of step with us */
+    if (serverriop->rio_cnt > 0) {
+        keepalive = 0;
+    }
+
+    /* The last chunk tells the client the body is complete */
+    if (sink.chunked && sink.fd >= 0 &&
+        rio_writeb(&sink.out, (void *)_lastChunk, sizeof(_lastChunk) - 1) < 0) {
+        sink.fd = -1;
+    }
+    sink_flush(&sink);
+
+    resultp->copied = sink.copy != NULL;
+    resultp->copylen = sink.copylen;
+    resultp->keepalive = keepalive;
+    resultp->clientkeepalive = clientkeepalive;
+    resultp->received = 1;
+    return sink.fd < 0 ? HTTP_RELAY_ERROR : HTTP_RELAY_OK;
+}
+
+/*
+ * http_relay_flight - Forward the response another request is fetching,
+ *          as its leader publishes it, to clientfd. Like
+ *          http_relay_response, the client's Connection header is our
+ *          own, and a body of unknown length is sent in chunks to a
+ *          client that takes them.
+ *
+ *  Return HTTP_RELAY_OK on success, HTTP_RELAY_EMPTY if the leader
+ *  failed before the response started (nothing was written), and
+ *  HTTP_RELAY_ERROR on any other error.
+ */
+int http_relay_flight(flight_reader_t *rp, int clientfd, int clientflags,
+                      http_relay_t *resultp)
+{
+    struct iovec iov[4];
+    char *hdr, *buf;
+    size_t hdrlen;
+    int delimited, chunked, clientkeepalive, i = 0;
+    ssize_t n;
+
+    memset(resultp, 0, sizeof(http_relay_t));
+    if (flight_wait_header(rp, &hdr, &hdrlen, &delimited) < 0) {
+        return HTTP_RELAY_EMPTY;
+    }
+    resultp->firstbyte = stats_now();
+    chunked = !delimited && (clientflags & HTTP_CLIENT_CHUNKED);
+    clientkeepalive = (clientflags & HTTP_CLIENT_KEEPALIVE) &&
+                      (delimited || chunked);
+
+    iov[i].iov_base = hdr;
+    iov[i++].iov_len = hdrlen;
+    if (chunked) {
+        iov[i].iov_base = (void *)_chunked;
+        iov[i++].iov_len = sizeof(_chunked) - 1;
+    }
+    if (clientkeepalive) {
+        iov[i].iov_base = (void *)_keepAlive;
+        iov[i++].iov_len = sizeof(_keepAlive) - 1;
+    }
+    else {
+        iov[i].iov_base = (void *)_close;
+        iov[i++].iov_len = sizeof(_close) - 1;
+    }
+    iov[i].iov_base = "\r\n";
+    iov[i++].iov_len = 2;
+    if (rio_writev(clientfd, iov, i) < 0) {
+        return HTTP_RELAY_ERROR;
+    }
+
+    while ((n = flight_read(rp, &buf)) > 0) {
+        if (chunked ? write_chunk(clientfd, buf, n) < 0 :
+                      rio_writen(clientfd, buf, n) != n) {
+            return HTTP_RELAY_ERROR;
+        }
+    }
+    if (n < 0) {
+        return HTTP_RELAY_ERROR;
+    }
+    if (chunked && rio_writen(clientfd, (void *)_lastChunk,
+                              sizeof(_lastChunk) - 1) != sizeof(_lastChunk) - 1) {
+        return HTTP_RELAY_ERROR;
+    }
+    resultp->received = 1;
+    resultp->clientkeepalive = clientkeepalive;
+    return HTTP_RELAY_OK;
+}
+
+/*
+ * http_send_cached - Send a cached response, adding the Connection header
+ *          (and Content-Length, if the server did not send one, so a
+ *          persistent connection stays in step).
+ *
+ *  Return 0 on success, -1 on error.
+ */
+int http_send_cached(int clientfd, char *object, size_t len, int clientkeepalive)
+{
+    struct iovec iov[HTTP_OBJECT_IOV];
+    char length[MAXLINE];
+    int n;
+
+    n = http_object_iov(object, len, length, clientkeepalive, iov);
+    return rio_writev(clientfd, iov, n) < 0 ? -1 : 0;
+}
+
+/*
+ * http_object_iov - Describe a cached response the way http_send_cached
+ *          sends it, as at most HTTP_OBJECT_IOV iov entries, for a caller
+ *          that writes it itself. A missing Content-Length line is
+ *          formatted into length, which must hold MAXLINE bytes; it and
+ *          object must stay in place until the response is written.
+ *
+ *  Return the number of entries used.
+ */
+int http_object_iov(char *object, size_t len, char *length,
+                    int clientkeepalive, struct iovec *iov)
+{
+    ssize_t hdrend;
+    int haslength;
+
+    if ((hdrend = http_object_header(object, len, &haslength)) < 0) {
+        iov[0].iov_base = object;
+        iov[0].iov_len = len;
+        return 1;
+    }
+    if (!haslength) {
+        sprintf(length, "Content-Length: %zu\r\n", len - hdrend - 2);
+    }
+    return object_iov(object, len, hdrend, haslength ? NULL : length,
+                      clientkeepalive, iov);
+}
+
+/*
+ * http_send_stored - Send a stored response whose header already has
+ *          Content-Length, adding the Connection header at hdrend.
+ *
+ *  Return 0 on success, -1 on error.
+ */
+int http_send_stored(int clientfd, char *object, size_t len, size_t hdrend,
+                     int clientkeepalive)
+{
+    struct iovec iov[HTTP_OBJECT_IOV];
+    int n;
+
+    n = object_iov(object, len, hdrend, NULL, clientkeepalive, iov);
+    return rio_writev(clientfd, iov, n) < 0 ? -1 : 0;
+}
+
+/*
+ * http_send_range - Answer a Range request from a cached response. A 200
+ *          response is cut down to 206 Partial Content with the one byte
+ *          range asked for, or 416 if the range starts past its end.
+ *          Anything else (other statuses, several ranges, other units) is
+ *          sent whole, which the client must accept too.
+ *
+ *  Return 0 on success, -1 on error.
+ */
+int http_send_range(int clientfd, char *object, size_t len, const char *range,
+                    int clientkeepalive)
+{
+    char fields[MAXLINE], *line, *status, *lengthline, *lengthend, *hdr;
+    struct iovec iov[8];
+    size_t size, first, last;
+    ssize_t hdrend;
+    int haslength, rc, n = 0;
+
+    if ((hdrend = http_object_header(object, len, &haslength)) < 0 ||
+        strncmp(object, "HTTP/1.", 7) || strncmp(object + 8, " 200", 4) ||
+        !(rc = parse_range(range, size = len - hdrend - 2, &first, &last))) {
+        return http_send_cached(clientfd, object, len, clientkeepalive);
+    }
+
+    /* Keep the server's header lines but its status and Content-Length */
+    hdr = object + hdrend;
+    status = strstr(object, "\r\n") + 2;
+    lengthline = lengthend = hdr;
+    for (line = status; line < hdr; line = strstr(line, "\r\n") + 2) {
+        if (!strncasecmp(line, "Content-Length:", 15)) {
+            lengthline = line;
+            lengthend = strstr(line, "\r\n") + 2;
+        }
+    }
+
+    iov[n].iov_base = object;
+    iov[n++].iov_len = 8;
+    if (rc < 0) {
+        iov[n].iov_base = (void *)_unsatisfiable;
+        iov[n++].iov_len = sizeof(_unsatisfiable) - 1;
+        sprintf(fields, "Content-Range: bytes */%zu\r\n"
+                "Content-Length: 0\r\n", size);
+    }
+    else {
+        iov[n].iov_base = (void *)_partial;
+        iov[n++].iov_len = sizeof(_partial) - 1;
+        iov[n].iov_base = status;
+        iov[n++].iov_len = lengthline - status;
+        iov[n].iov_base = lengthend;
+        iov[n++].iov_len = hdr - lengthend;
+        sprintf(fields, "Content-Range: bytes %zu-%zu/%zu\r\n"
+                "Content-Length: %zu\r\n", first, last, size,
+                last - first + 1);
+    }
+    iov[n].iov_base = fields;
+    iov[n++].iov_len = strlen(fields);
+    if (clientkeepalive) {
+        iov[n].iov_base = (void *)_keepAlive;
+        iov[n++].iov_len = sizeof(_keepAlive) - 1;
+    }
+    else {
+        iov[n].iov_base = (void *)_close;
+        iov[n++].iov_len = sizeof(_close) - 1;
+    }
+    iov[n].iov_base = hdr;
+    iov[n++].iov_len = 2;
+    if (rc > 0) {
+        iov[n].iov_base = hdr + 2 + first;
+        iov[n++].iov_len = last - first + 1;
+    }
+
+    return rio_writev(clientfd, iov, n) < 0 ? -1 : 0;
+}
+
+/*
+ * http_object_header - Find where the header of a cached response ends,
+ *          just before its blank line, and whether it has Content-Length.
+ *
+ *  Return that offset, or -1 if the header is incomplete.
+ */
+ssize_t http_object_header(char *object, size_t len, int *haslengthp)
+{
+    char *end, *line;
+
+    if (!(end = header_end(object, len))) {
+        return -1;
+    }
+    end += 2;
+
+    *haslengthp = 0;
+    for (line = object; line < end; line = strstr(line, "\r\n") + 2) {
+        if (!strncasecmp(line, "Content-Length:", 15)) {
+            *haslengthp = 1;
+        }
+    }
+    return end - object;
+}
+
+/*
+ * http_header_strip - Drop the hop-by-hop header lines (Connection,
+ *          Proxy-Connection and Keep-Alive) from the response read into
+ *          the *lenp bytes at buf, moving what follows them (body bytes
+ *          too) down and updating *lenp. Stores in *lengthp how many body
+ *          bytes follow the header: its Content-Length, 0 for a status
+ *          without a body, or -1 when the body ends with the connection.
+ *
+ *  Return where the header ends, just before its blank line, or -1 if
+ *  the blank line is not in buf yet.
+ */
+ssize_t http_header_strip(char *buf, size_t *lenp, long *lengthp)
+{
+    char *end, *line, *next;
+    long length = -1;
+    int status = 0, chunked = 0;
+
+    if (!(end = header_end(buf, *lenp))) {
+        return -1;
+    }
+    end += 2;
+    if (end - buf > 12 && !strncmp(buf, "HTTP/1.", 7) && buf[8] == ' ') {
+        status = atoi(buf + 9);
+    }
+
+    /* Every line before end ends with its own newline */
+    line = (char *)memchr(buf, '\n', end - buf) + 1;
+    for (; line < end; line = next) {
+        next = (char *)memchr(line, '\n', end - line) + 1;
+        if (!strncasecmp(line, "Content-Length:", 15)) {
+            length = atol(line + 15);
+        }
+        else if (!strncasecmp(line, "Transfer-Encoding:", 18)) {
+            chunked = 1;
+        }
+        else if (!strncasecmp(line, "Connection:", 11) ||
+                 !strncasecmp(line, "Proxy-Connection:", 17) ||
+                 !strncasecmp(line, "Keep-Alive:", 11)) {
+            memmove(line, next, buf + *lenp - next);
+            *lenp -= next - line;
+            end -= next - line;
+            next = line;
+        }
+    }
+
+    if ((status >= 100 && status < 200) || status == 204 || status == 304) {
+        *lengthp = 0;
+    }
+    else {
+        *lengthp = chunked ? -1 : length;
+    }
+    return end - buf;
+}
+
+/*
+ * http_object_complete - Is a response relayed as is worth caching: a
+ *          200 with a whole header and as many body bytes as its
+ *          Content-Length says? Chunked bodies are left undecoded in
+ *          such a copy, so they never are.
+ */
+int http_object_complete(char *object, size_t len)
+{
+    char *end, *line;
+    long length = -1;
+
+    if (len < 12 || strncmp(object, "HTTP/1.", 7) ||
+        strncmp(object + 8, " 200", 4) || !(end = header_end(object, len))) {
+        return 0;
+    }
+    end += 2;
+
+    for (line = object; line < end; line = strstr(line, "\r\n") + 2) {
+        if (!strncasecmp(line, "Content-Length:", 15)) {
+            length = atol(line + 15);
+        }
+        else if (!strncasecmp(line, "Transfer-Encoding:", 18)) {
+            return 0;
+        }
+    }
+    return length < 0 || length == len - (end + 2 - object);
+}
+
+/*
+ * http_error_iov - Describe the canned response for an HTTP error status
+ *          as HTTP_ERROR_IOV iov entries, all constant strings. The
+ *          response says the connection closes after it.
+ */
+void http_error_iov(int status, struct iovec *iov)
+{
+    int i;
+
+    for (i = 0; errors[i].status && errors[i].status != status; i++)
+        ;
+    iov[0].iov_base = (void *)errors[i].line;
+    iov[0].iov_len = strlen(errors[i].line);
+    iov[1].iov_base = (void *)_errorHeader;
+    iov[1].iov_len = sizeof(_errorHeader) - 1;
+    iov[2].iov_base = (void *)errors[i].body;
+    iov[2].iov_len = strlen(errors[i].body);
+}
+
+/*
+ * http_send_error - Send the canned response for status to the client.
+ *
+ *  Return 0 on success, -1 on error.
+ */
+int http_send_error(int clientfd, int status)
+{
+    struct iovec iov[HTTP_ERROR_IOV];
+
+    http_error_iov(status, iov);
+    return rio_writev(clientfd, iov, HTTP_ERROR_IOV) < 0 ? -1 : 0;
+}
+
+/*
+ * object_iov - Describe a response in memory as iov entries, putting the
+ *          length line (if any) and our Connection header at hdrend.
+ *          Returns the number of entries, at most HTTP_OBJECT_IOV.
+ */
+static int object_iov(char *object, size_t len, size_t hdrend, char *length,
+                      int clientkeepalive, struct iovec *iov)
+{
+    int n = 0;
+
+    iov[n].iov_base = object;
+    iov[n++].iov_len = hdrend;
+    if (length) {
+        iov[n].iov_base = length;
+        iov[n++].iov_len = strlen(length);
+    }
+    if (clientkeepalive) {
+        iov[n].iov_base = (void *)_keepAlive;
+        iov[n++].iov_len = sizeof(_keepAlive) - 1;
+    }
+    else {
+        iov[n].iov_base = (void *)_close;
+        iov[n++].iov_len = sizeof(_close) - 1;
+    }
+    iov[n].iov_base = object + hdrend;
+    iov[n++].iov_len = len - hdrend;
+    return n;
+}
+
+/*
+ * parse_range - Read a Range header value asking for one byte range
+ *          ("bytes=first-last", "bytes=first-" or "bytes=-suffix") of a
+ *          size byte body, clamped to the body, into [*firstp, *lastp].
+ *
+ *  Return 1 for a range to send, -1 if it starts past the end, 0 if the
+ *  header is malformed or asks for something else and should be ignored.
+ */
+static int parse_range(const char *range, size_t size, size_t *firstp,
+                       size_t *lastp)
+{
+    unsigned long long first, last;
+    char *end;
+
+    if (strncasecmp(range, "bytes=", 6) || strchr(range, ',')) {
+        return 0;
+    }
+    range += 6;
+
+    /* The last n bytes */
+    if (*range == '-') {
+        if (!isdigit((unsigned char)range[1])) {
+            return 0;
+        }
+        last = strtoull(range + 1, &end, 10);
+        if (*end) {
+            return 0;
+        }
+        if (!last || !size) {
+            return -1;
+        }
+        *firstp = last < size ? size - last : 0;
+        *lastp = size - 1;
+        return 1;
+    }
+
+    if (!isdigit((unsigned char)*range)) {
+        return 0;
+    }
+    first = strtoull(range, &end, 10);
+    if (*end++ != '-') {
+        return 0;
+    }
+    last = ~0ULL;
+    if (*end) {
+        if (!isdigit((unsigned char)*end)) {
+            return 0;
+        }
+        last = strtoull(end, &end, 10);
+        if (*end || last < first) {
+            return 0;
+        }
+    }
+    if (first >= size) {
+        return -1;
+    }
+    *firstp = first;
+    *lastp = last < size ? last : size - 1;
+    return 1;
+}
+
+/*
+ * has_token - Is token one of the comma-separated items of a header
+ *          value (any case)? The value runs to the end of its line.
+ */
+static int has_token(const char *value, const char *token)
+{
+    const char *t;
+    size_t len = strlen(token);
+
+    while (*value) {
+        value += strspn(value, " \t,\r\n");
+        t = value;
+        value += strcspn(value, " \t,\r\n");
+        if (value - t == len && !strncasecmp(t, token, len)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * header_end - Find the "\r\n\r\n" that ends the header in buf.
+ */
+static char *header_end(char *buf, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i + 4 <= len; i++) {
+        if (!memcmp(buf + i, "\r\n\r\n", 4)) {
+            return buf + i;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * write_chunk - Send n > 0 bytes as one chunk of a chunked body.
+ *          Returns -1 on error, 0 on success.
+ */
+static int write_chunk(int fd, char *buf, size_t n)
+{
+    struct iovec iov[3];
+    char size[32];
+
+    iov[0].iov_base = size;
+    iov[0].iov_len = sprintf(size, "%zx\r\n", n);
+    iov[1].iov_base = buf;
+    iov[1].iov_len = n;
+    iov[2].iov_base = "\r\n";
+    iov[2].iov_len = 2;
+    return rio_writev(fd, iov, 3) < 0 ? -1 : 0;
+}
+
+/*
+ * sink_write - Send n bytes to the client and the followers, and keep a
+ *          copy if possible. A failed client is dropped while followers
+ *          still want the bytes. Returns -1 on error, 0 on success.
+ */
+static int sink_write(sink_t *sp, char *buf, size_t n)
+{
+    if (n == 0) {
+        return 0;
+    }
+    if (sp->fd >= 0 && sink_out(sp, buf, n) < 0) {
+        if (!sp->flight) {
+            return -1;
+        }
+        sp->fd = -1;
+    }
+    if (sp->flight && !flight_append(sp->flight, buf, n)) {
+        sp->flight = NULL;      /* Nobody is following any more */
+        if (sp->fd < 0) {
+            return -1;
+        }
+    }
+    sink_keep(sp, buf, n);
+    return 0;
+}
+
+/*
+ * sink_out - Queue n bytes for the client, framed as a chunk if it gets
+ *          a chunked body. Returns -1 on error, 0 on success.
+ */
+static int sink_out(sink_t *sp, char *buf, size_t n)
+{
+    char size[32];
+
+    if (sp->chunked &&
+        rio_writeb(&sp->out, size, sprintf(size, "%zx\r\n", n)) < 0) {
+        return -1;
+    }
+    if (rio_writeb(&sp->out, buf, n) < 0) {
+        return -1;
+    }
+    if (sp->chunked && rio_writeb(&sp->out, "\r\n", 2) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * sink_flush - Send the client what its write buffer holds, before
+ *          anything that may block. Like sink_write, a failed client is
+ *          dropped while followers still want the bytes. Returns -1 on
+ *          error, 0 on success.
+ */
+static int sink_flush(sink_t *sp)
+{
+    if (sp->fd >= 0 && rio_flush(&sp->out) < 0) {
+        if (!sp->flight) {
+            return -1;
+        }
+        sp->fd = -1;
+    }
+    return 0;
+}
+
+/*
+ * sink_keep - Add n bytes to the copy only, abandoning it if it is full.
+ */
+static void sink_keep(sink_t *sp, char *buf, size_t n)
+{
+    if (sp->copy) {
+        if (sp->copylen + n <= sp->copycap) {
+            memcpy(sp->copy + sp->copylen, buf, n);
+            sp->copylen += n;
+        }
+        else {
+            sp->copy = NULL;
+        }
+    }
+}
+
+/*
+ * relay_copy - Move up to n bytes through a user buffer. Returns the
+ *          bytes moved, 0 on EOF, -2 on error.
+ */
+static ssize_t relay_copy(int serverfd, sink_t *sp, size_t n)
+{
+    char buf[RELAY_CHUNK];
+    ssize_t rc;
+
+    while ((rc = read(serverfd, buf, n)) < 0) {
+        if (errno != EINTR) {
+            return -2;
+        }
+    }
+    if (rc > 0 && sink_write(sp, buf, rc) < 0) {
+        return -2;
+    }
+    return rc;
+}
+
+/*
+ * relay_chunked - Decode a chunked body from rp and pass its data on as
+ *          it arrives, at most RELAY_CHUNK bytes at a time. The last
+ *          chunk and the trailer (which is dropped) are consumed too, so
+ *          the connection is ready for the next response. Data the rio
+ *          buffer holds is passed on from there; past it, large chunks
+ *          are read straight from the socket. Output is flushed only
+ *          before a read that may block, so the chunks of one read reach
+ *          the client in one write. Returns 0 on success, -1 on error or
+ *          EOF before the end.
+ */
+static int relay_chunked(rio_t *rp, sink_t *sp)
+{
+    char buf[RELAY_CHUNK], line[MAXLINE], *end;
+    unsigned long size;
+    ssize_t n;
+
+    while (1) {
+        /* Chunk size in hex, perhaps followed by extensions */
+        if ((!line_buffered(rp) && sink_flush(sp) < 0) ||
+            rio_readlineb(rp, line, MAXLINE) <= 0) {
+            return -1;
+        }
+        size = strtoul(line, &end, 16);
+        if (end == line || !strchr(";\r\n \t", *end) || *end == '\0') {
+            return -1;
+        }
+        if (size == 0) {
+            break;
+        }
+
+        while (size > 0) {
+            if (rp->rio_cnt > 0) {
+                n = size < rp->rio_cnt ? size : rp->rio_cnt;
+                if (sink_write(sp, rp->rio_bufptr, n) < 0) {
+                    return -1;
+                }
+                rp->rio_bufptr += n;
+                rp->rio_cnt -= n;
+            }
+            else {
+                if (sink_flush(sp) < 0) {
+                    return -1;
+                }
+                while ((n = read(rp->rio_fd, buf,
+                                 size < RELAY_CHUNK ? size : RELAY_CHUNK)) < 0) {
+                    if (errno != EINTR) {
+                        return -1;
+                    }
+                }
+                if (n == 0 || sink_write(sp, buf, n) < 0) {
+                    return -1;
+                }
+            }
+            size -= n;
+        }
+
+        /* Each chunk's data ends with a line break */
+        if ((!line_buffered(rp) && sink_flush(sp) < 0) ||
+            rio_readlineb(rp, line, MAXLINE) <= 0 ||
+            (strcmp(line, "\r\n") && strcmp(line, "\n"))) {
+            return -1;
+        }
+    }
+
+    /* Trailer fields, up to a blank line */
+    while ((n = rio_readlineb(rp, line, MAXLINE)) > 0) {
+        if (!strcmp(line, "\r\n") || !strcmp(line, "\n")) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * line_buffered - Is a whole line waiting in rp's buffer?
+ */
+static int line_buffered(rio_t *rp)
+{
+    return rp->rio_cnt > 0 && memchr(rp->rio_bufptr, '\n', rp->rio_cnt);
+}
+
+/*
+ * relay_splice - Move up to n bytes through the thread's pipe without
+ *          copying them to user space. Returns the bytes moved, 0 on EOF,
+ *          -1 when splice is not available (use relay_copy), -2 on error.
+ */
+static ssize_t relay_splice(int serverfd, sink_t *sp, size_t n)
+{
+#ifdef SYS_splice
+    ssize_t in, out, left;
+
+    if (relay_pipe[0] < 0 && pipe(relay_pipe) < 0) {
+        return -1;
+    }
+
+    while ((in = syscall(SYS_splice, serverfd, NULL, relay_pipe[1], NULL,
+                         n, RELAY_SPLICE_MOVE | RELAY_SPLICE_MORE)) < 0) {
+        if (errno == EINVAL || errno == ENOSYS) {
+            return -1;
+        }
+        if (errno != EINTR) {
+            return -2;
+        }
+    }
+
+    /* Drain the pipe completely so it is empty for the next call */
+    for (left = in; left > 0; left -= out) {
+        out = syscall(SYS_splice, relay_pipe[0], NULL, sp->fd, NULL,
+                      left, RELAY_SPLICE_MOVE | RELAY_SPLICE_MORE);
+        if (out < 0) {
+            if (errno == EINTR) {
+                out = 0;
+                continue;
+            }
+            /* The pipe now holds stale data: start over with a new one */
+            Close(relay_pipe[0]);
+            Close(relay_pipe[1]);
+            relay_pipe[0] = relay_pipe[1] = -1;
+            return -2;
+        }
+    }
+    return in;
+#else
+    return -1;
+#endif
+}
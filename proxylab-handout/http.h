@@ -0,0 +1,67 @@
+/*
+ * http.h - HTTP response handling for the proxy.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ */
+#ifndef __HTTP_H__
+#define __HTTP_H__
+
+#include "csapp.h"
+#include "flight.h"
+
+/* Bytes moved per read/write (or splice) while relaying a body */
+#define RELAY_CHUNK (64 * 1024)
+
+/* Client write buffer: small pieces of a response (header, chunk
+   framing, short reads) are gathered into one write */
+#define RELAY_OUTBUF (16 * 1024)
+
+/* What http_relay_response learned about the response */
+typedef struct {
+    int copied;         /* The whole response is in the copy */
+    size_t copylen;     /* Bytes in the copy */
+    int keepalive;      /* The server connection can be reused */
+    int clientkeepalive; /* The client connection stays open */
+    unsigned long firstbyte; /* stats_now() when the status line arrived */
+    int received;       /* The whole response was read from the server */
+} http_relay_t;
+
+/* Error statuses the proxy answers with, and iov entries per response */
+#define HTTP_BAD_REQUEST     400
+#define HTTP_NOT_IMPLEMENTED 501
+#define HTTP_BAD_GATEWAY     502
+#define HTTP_ERROR_IOV       3
+
+/* Most iov entries http_object_iov uses */
+#define HTTP_OBJECT_IOV      4
+
+/* What the client accepts, for http_relay_response and http_relay_flight */
+#define HTTP_CLIENT_KEEPALIVE 0x1   /* Wants its connection kept open */
+#define HTTP_CLIENT_CHUNKED   0x2   /* Speaks HTTP/1.1, so takes chunked bodies */
+
+/* http_relay_response return values */
+#define HTTP_RELAY_OK     0     /* Response forwarded */
+#define HTTP_RELAY_ERROR  -1    /* Failed part way through */
+#define HTTP_RELAY_EMPTY  -2    /* Server closed before sending anything */
+
+int http_relay_response(rio_t *serverriop, int clientfd, int clientflags,
+                        char *copy, size_t copycap, flight_t *flight,
+                        http_relay_t *resultp);
+int http_relay_flight(flight_reader_t *rp, int clientfd, int clientflags,
+                      http_relay_t *resultp);
+int http_send_cached(int clientfd, char *object, size_t len, int clientkeepalive);
+int http_object_iov(char *object, size_t len, char *length,
+                    int clientkeepalive, struct iovec *iov);
+int http_send_stored(int clientfd, char *object, size_t len, size_t hdrend,
+                     int clientkeepalive);
+int http_send_range(int clientfd, char *object, size_t len, const char *range,
+                    int clientkeepalive);
+ssize_t http_object_header(char *object, size_t len, int *haslengthp);
+int http_object_complete(char *object, size_t len);
+ssize_t http_header_strip(char *buf, size_t *lenp, long *lengthp);
+void http_error_iov(int status, struct iovec *iov);
+int http_send_error(int clientfd, int status);
+
+#endif /* __HTTP_H__ */
@@ -0,0 +1,498 @@
+/*
+ * loadgen.c - Load generator and latency benchmark for the proxy.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ * Keeps a fixed number of connections busy for a fixed time, each one
+ * sending a GET, reading the whole response and sending the next, and
+ * reports requests per second, throughput and latency percentiles.
+ * Connections are non-blocking and multiplexed with epoll; with -t,
+ * each thread runs its own loop over its share of the connections.
+ *
+ * Workloads (-m):
+ *   repeat  every request asks for the same URL (cache hits)
+ *   unique  a "?n=<counter>" query makes every URL new (cache misses)
+ *   large   the same large object, by default /large.bin, which should
+ *           be bigger than MAX_OBJECT_SIZE so it is always relayed
+ *
+ * Latencies go into the same log-linear histogram the proxy uses for its
+ * own statistics (stats.c), so percentiles cost no sorting.
+ *
+ * usage: loadgen -s host:port [-p host:port] [-c conns] [-d secs]
+ *                [-t threads] [-m repeat|unique|large] [-u path] [-C]
+ */
+
+#include <sys/epoll.h>
+#include "csapp.h"
+#include "stats.h"
+
+#define DEFAULT_CONNS 16
+#define DEFAULT_SECS 10
+#define MAXEVENTS 64
+
+typedef enum { MODE_REPEAT, MODE_UNIQUE, MODE_LARGE } workload_t;
+
+/* Connection states */
+typedef enum {
+    LC_CONNECTING,      /* Waiting for a non-blocking connect */
+    LC_SENDING,         /* Writing the request */
+    LC_READING          /* Reading the response */
+} lc_state_t;
+
+/* One client connection */
+typedef struct {
+    int fd;
+    lc_state_t state;
+    char req[MAXLINE];
+    size_t reqlen, sent;
+    char hdr[MAXBUF];       /* Response header read so far */
+    size_t hdrlen;
+    int inbody;
+    long remaining;         /* Body bytes left, -1 means until EOF */
+    int keepalive;          /* Server will keep the connection open */
+    double start;           /* When the request (or connect) began */
+} lconn_t;
+
+/* Per-thread results */
+typedef struct {
+    int nconns;
+    unsigned long requests;
+    unsigned long errors;
+    unsigned long bytes;
+    unsigned long hist[STATS_HIST_BUCKETS];
+    double maxlat;
+} worker_t;
+
+/* Settings shared by all threads */
+static struct addrinfo *target;
+static char *server;            /* host:port of the origin */
+static int viaproxy;
+static char *path;
+static workload_t mode = MODE_REPEAT;
+static int closeeach = 0;
+static double deadline;
+static unsigned long seq;       /* Counter for unique URLs */
+
+static double now(void);
+static void *worker(void *vargp);
+static void start_conn(int epfd, lconn_t *c, worker_t *wp);
+static void start_request(lconn_t *c);
+static int on_event(int epfd, lconn_t *c, worker_t *wp);
+static int on_read(lconn_t *c, worker_t *wp);
+static void finish(int epfd, lconn_t *c, worker_t *wp, int ok);
+static unsigned long percentile(unsigned long *hist, unsigned long total,
+                                double pct, unsigned long max);
+static void usage(char *prog);
+
+
+int main(int argc, char **argv) {
+    int opt, i, nconns = DEFAULT_CONNS, secs = DEFAULT_SECS, nthreads = 1;
+    char *proxy = NULL, *dest, host[MAXLINE], *colon;
+    struct addrinfo hints;
+    worker_t *workers, total;
+    pthread_t *tids;
+    double begin, elapsed;
+    unsigned long maxus;
+    int rc, b;
+
+    while ((opt = getopt(argc, argv, "s:p:c:d:t:m:u:C")) != -1) {
+        switch (opt) {
+            case 's':
+                server = optarg;
+                break;
+            case 'p':
+                proxy = optarg;
+                break;
+            case 'c':
+                nconns = atoi(optarg);
+                break;
+            case 'd':
+                secs = atoi(optarg);
+                break;
+            case 't':
+                nthreads = atoi(optarg);
+                break;
+            case 'm':
+                if (!strcmp(optarg, "repeat")) {
+                    mode = MODE_REPEAT;
+                }
+                else if (!strcmp(optarg, "unique")) {
+                    mode = MODE_UNIQUE;
+                }
+                else if (!strcmp(optarg, "large")) {
+                    mode = MODE_LARGE;
+                }
+                else {
+                    usage(argv[0]);
+                }
+                break;
+            case 'u':
+                path = optarg;
+                break;
+            case 'C':
+                closeeach = 1;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (!server || nconns <= 0 || secs <= 0 || nthreads <= 0 ||
+        nthreads > nconns) {
+        usage(argv[0]);
+    }
+    if (!path) {
+        path = mode == MODE_LARGE ? "/large.bin" : "/home.html";
+    }
+
+    /* Resolve whoever we actually connect to */
+    viaproxy = proxy != NULL;
+    dest = viaproxy ? proxy : server;
+    strncpy(host, dest, MAXLINE - 1);
+    host[MAXLINE - 1] = '\0';
+    if (!(colon = strrchr(host, ':'))) {
+        usage(argv[0]);
+    }
+    *colon = '\0';
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+    if ((rc = getaddrinfo(host, colon + 1, &hints, &target)) != 0) {
+        gai_error(rc, "getaddrinfo error");
+    }
+
+    Signal(SIGPIPE, SIG_IGN);
+    workers = Calloc(nthreads, sizeof(worker_t));
+    tids = Calloc(nthreads, sizeof(pthread_t));
+    begin = now();
+    deadline = begin + secs;
+    for (i = 0; i < nthreads; i++) {
+        workers[i].nconns = nconns / nthreads + (i < nconns % nthreads);
+        Pthread_create(&tids[i], NULL, worker, &workers[i]);
+    }
+
+    /* Merge the results */
+    memset(&total, 0, sizeof(worker_t));
+    for (i = 0; i < nthreads; i++) {
+        Pthread_join(tids[i], NULL);
+        total.requests += workers[i].requests;
+        total.errors += workers[i].errors;
+        total.bytes += workers[i].bytes;
+        for (b = 0; b < STATS_HIST_BUCKETS; b++) {
+            total.hist[b] += workers[i].hist[b];
+        }
+        if (workers[i].maxlat > total.maxlat) {
+            total.maxlat = workers[i].maxlat;
+        }
+    }
+    elapsed = now() - begin;
+
+    printf("%s %s%s, %d connections%s, %d threads, %.1f s\n",
+           mode == MODE_REPEAT ? "repeat" :
+           mode == MODE_UNIQUE ? "unique" : "large",
+           server, path, nconns, closeeach ? " (close each)" : "",
+           nthreads, elapsed);
+    printf("requests     %lu (%lu errors)\n", total.requests, total.errors);
+    printf("req/s        %.1f\n", total.requests / elapsed);
+    printf("throughput   %.2f MB/s\n", total.bytes / elapsed / (1 << 20));
+    maxus = (unsigned long)(total.maxlat * 1e6);
+    printf("latency us   p50 %lu  p90 %lu  p99 %lu  p999 %lu  max %lu\n",
+           percentile(total.hist, total.requests, 0.50, maxus),
+           percentile(total.hist, total.requests, 0.90, maxus),
+           percentile(total.hist, total.requests, 0.99, maxus),
+           percentile(total.hist, total.requests, 0.999, maxus), maxus);
+
+    freeaddrinfo(target);
+    return total.requests ? 0 : 1;
+}
+
+/*
+ * now - Monotonic time in seconds
+ */
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * worker - Thread routine. Drive this thread's connections until the
+ *          deadline; requests still in flight then are not counted.
+ */
+static void *worker(void *vargp) {
+    worker_t *wp = vargp;
+    struct epoll_event events[MAXEVENTS];
+    lconn_t *conns;
+    int epfd, i, n;
+
+    if ((epfd = epoll_create1(0)) < 0) {
+        unix_error("epoll_create1 error");
+    }
+    conns = Calloc(wp->nconns, sizeof(lconn_t));
+    for (i = 0; i < wp->nconns; i++) {
+        start_conn(epfd, &conns[i], wp);
+    }
+
+    while (now() < deadline) {
+        if ((n = epoll_wait(epfd, events, MAXEVENTS, 100)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            unix_error("epoll_wait error");
+        }
+        for (i = 0; i < n; i++) {
+            lconn_t *c = events[i].data.ptr;
+            if (on_event(epfd, c, wp) < 0) {
+                finish(epfd, c, wp, 0);
+            }
+        }
+    }
+
+    for (i = 0; i < wp->nconns; i++) {
+        if (conns[i].fd >= 0) {
+            Close(conns[i].fd);
+        }
+    }
+    Free(conns);
+    Close(epfd);
+    return NULL;
+}
+
+/*
+ * start_conn - Open a new connection and queue its first request. The
+ *          latency of that request includes the connect.
+ */
+static void start_conn(int epfd, lconn_t *c, worker_t *wp) {
+    struct addrinfo *p;
+    struct epoll_event ev;
+
+    c->start = now();
+    for (p = target; p; p = p->ai_next) {
+        if ((c->fd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK,
+                            p->ai_protocol)) < 0) {
+            continue;
+        }
+        if (connect(c->fd, p->ai_addr, p->ai_addrlen) == 0 ||
+            errno == EINPROGRESS) {
+            break;
+        }
+        Close(c->fd);
+    }
+    if (!p) {
+        fprintf(stderr, "loadgen: cannot connect: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    c->state = LC_CONNECTING;
+    start_request(c);
+    ev.events = EPOLLOUT;
+    ev.data.ptr = c;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+        unix_error("epoll_ctl error");
+    }
+}
+
+/*
+ * start_request - Build the next request for c
+ */
+static void start_request(lconn_t *c) {
+    char query[32] = "";
+    const char *conn = closeeach ? "close" : "keep-alive";
+
+    if (mode == MODE_UNIQUE) {
+        sprintf(query, "?n=%lu", __sync_fetch_and_add(&seq, 1));
+    }
+    c->reqlen = snprintf(c->req, MAXLINE,
+                         "GET %s%s%s%s HTTP/1.0\r\n"
+                         "Host: %s\r\n"
+                         "Connection: %s\r\n"
+                         "%s%s%s\r\n",
+                         viaproxy ? "http://" : "", viaproxy ? server : "",
+                         path, query, server, conn,
+                         viaproxy ? "Proxy-Connection: " : "",
+                         viaproxy ? conn : "", viaproxy ? "\r\n" : "");
+    c->sent = 0;
+    c->hdrlen = 0;
+    c->inbody = 0;
+    c->remaining = -1;
+    c->keepalive = 0;
+}
+
+/*
+ * on_event - Advance c's state machine. Returns -1 on error.
+ */
+static int on_event(int epfd, lconn_t *c, worker_t *wp) {
+    struct epoll_event ev;
+    int err = 0, rc;
+    socklen_t len = sizeof(err);
+    ssize_t n;
+
+    if (c->state == LC_CONNECTING) {
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+            return -1;
+        }
+        c->state = LC_SENDING;
+    }
+
+    if (c->state == LC_SENDING) {
+        while (c->sent < c->reqlen) {
+            n = send(c->fd, c->req + c->sent, c->reqlen - c->sent, 0);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+            }
+            c->sent += n;
+        }
+        c->state = LC_READING;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
+            unix_error("epoll_ctl error");
+        }
+        return 0;
+    }
+
+    if ((rc = on_read(c, wp)) > 0) {
+        finish(epfd, c, wp, 1);
+    }
+    return rc;
+}
+
+/*
+ * on_read - Read what has arrived. Returns 1 when the response is
+ *          complete, 0 if more is expected, -1 on error.
+ */
+static int on_read(lconn_t *c, worker_t *wp) {
+    char buf[MAXBUF], *end, *line;
+    ssize_t n;
+    size_t body;
+    int status;
+
+    while (1) {
+        if (!c->inbody) {
+            n = read(c->fd, c->hdr + c->hdrlen, MAXBUF - 1 - c->hdrlen);
+        }
+        else {
+            n = read(c->fd, buf, MAXBUF);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        if (n == 0) {
+            /* EOF ends a body without Content-Length */
+            return c->inbody && c->remaining < 0 ? 1 : -1;
+        }
+        wp->bytes += n;
+
+        if (c->inbody) {
+            if (c->remaining >= 0 && (c->remaining -= n) <= 0) {
+                return c->remaining == 0 ? 1 : -1;
+            }
+            continue;
+        }
+
+        /* Still in the header */
+        c->hdrlen += n;
+        c->hdr[c->hdrlen] = '\0';
+        if (!(end = strstr(c->hdr, "\r\n\r\n"))) {
+            if (c->hdrlen == MAXBUF - 1) {
+                return -1;
+            }
+            continue;
+        }
+        if (sscanf(c->hdr, "HTTP/%*d.%*d %d", &status) != 1 ||
+            status < 200 || status >= 300) {
+            return -1;
+        }
+        c->keepalive = !strncmp(c->hdr, "HTTP/1.1", 8);
+        for (line = strstr(c->hdr, "\r\n") + 2; line < end;
+             line = strstr(line, "\r\n") + 2) {
+            if (!strncasecmp(line, "Content-Length:", 15)) {
+                c->remaining = atol(line + 15);
+            }
+            else if (!strncasecmp(line, "Connection:", 11)) {
+                c->keepalive = !strncasecmp(line + 11, " keep-alive", 11);
+            }
+        }
+        c->inbody = 1;
+        body = c->hdr + c->hdrlen - (end + 4);
+        if (c->remaining >= 0) {
+            if (body > c->remaining) {
+                return -1;
+            }
+            if ((c->remaining -= body) == 0) {
+                return 1;
+            }
+        }
+    }
+}
+
+/*
+ * finish - Record a finished (ok) or failed request and start the next,
+ *          on the same connection when the server keeps it open.
+ */
+static void finish(int epfd, lconn_t *c, worker_t *wp, int ok) {
+    struct epoll_event ev;
+    double t = now(), lat = t - c->start;
+
+    if (t >= deadline) {
+        return;     /* Measurement is over */
+    }
+    if (ok) {
+        wp->requests++;
+        wp->hist[stats_hist_index((unsigned long)(lat * 1e6))]++;
+        if (lat > wp->maxlat) {
+            wp->maxlat = lat;
+        }
+    }
+    else {
+        wp->errors++;
+    }
+
+    if (ok && !closeeach && c->keepalive && c->remaining == 0) {
+        start_request(c);
+        c->start = t;
+        c->state = LC_SENDING;
+        ev.events = EPOLLOUT;
+        ev.data.ptr = c;
+        if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
+            unix_error("epoll_ctl error");
+        }
+        return;
+    }
+    Close(c->fd);
+    start_conn(epfd, c, wp);
+}
+
+/*
+ * percentile - Smallest latency that pct of the requests did not exceed,
+ *          no larger than the max actually seen
+ */
+static unsigned long percentile(unsigned long *hist, unsigned long total,
+                                double pct, unsigned long max) {
+    unsigned long seen = 0, want = (unsigned long)(total * pct);
+    int i;
+
+    if (want == 0) {
+        want = 1;
+    }
+    for (i = 0; i < STATS_HIST_BUCKETS; i++) {
+        if ((seen += hist[i]) >= want) {
+            return stats_hist_value(i) < max ? stats_hist_value(i) : max;
+        }
+    }
+    return 0;
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "usage: %s -s host:port [-p proxyhost:port] [-c conns] "
+            "[-d secs] [-t threads]\n"
+            "       [-m repeat|unique|large] [-u path] [-C]\n", prog);
+    exit(1);
+}
@@ -3,239 +3,448 @@
  * Name: Aihua Peng
  * AndrewID: aihuap
  *
- * This is a multithreadable web proxy without cache.
- * It could delegate GET request from client.
+ * This is a multithreadable web proxy with a shared in-memory cache.
+ * It could delegate GET request from client. Complete 200 responses no
+ * larger than MAX_OBJECT_SIZE are cached, keyed by host:port/path, and
+ * repeated requests are served from memory without contacting the server.
+ * Client connections are persistent (HTTP/1.1, or keep-alive requested)
+ * and pipelined requests are answered in order. Concurrent misses on the
+ * same object share one server request (see flight.c). With -d, objects
+ * are also kept on disk and survive restarts (see diskcache.c).
  *
  */
 
 #include <stdio.h>
+#include <netinet/tcp.h>
 #include "csapp.h"
+#include "request.h"
+#include "cache.h"
+#include "diskcache.h"
+#include "sbuf.h"
+#include "event.h"
+#include "http.h"
+#include "upstream.h"
+#include "flight.h"
+#include "stats.h"
 
-/* Helper macro */
-#define NOT_MATCH(a, b) (strncmp(a, b, strlen(b)))
+/* Default worker pool size and connection queue depth */
+#define NTHREADS 16
+#define SBUFSIZE 64
 
-/* Global static representatives */
-static const char *_userAgent= "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n";
-static const char *_accept = "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n";
-static const char *_acceptEncoding = "Accept-Encoding: gzip, deflate\r\n";
-static const char *_connection = "Connection: close\r\n";
-static const char *_proxyConnection = "Proxy-Connection: close\r\n";
+/* Default seconds an idle persistent client connection is kept */
+#define CLIENT_IDLE_TIMEOUT 5
 
+/* Most connections taken from the listening socket at once */
+#define ACCEPT_BATCH 16
 
-/* Thread function */
-void *doit(void *connfdp);
+/* Reuse server connections (-k) */
+static int upstream_keepalive = 0;
+
+/* Idle timeout for persistent client connections (-c) */
+static int client_timeout = CLIENT_IDLE_TIMEOUT;
+
+/* Threads use io_uring where the kernel has it, unless -U */
+static int use_uring = 1;
 
-/* Helper functions */
-int parse_uri(char *uri, char *host, char *port, char *suffix);
-void construct_requestLine(char *requestLineBuf, char *suffix);
-void construct_messageHeader(char *messageHeaderBuf, rio_t *clientriop, char *host);
-void construct_header (rio_t *clientriop, char *to_server_buf, char *host, char *suffix);
+/* Connected descriptors waiting for a worker */
+static sbuf_t sbuf;
+
+/* Thread function */
+void *thread(void *vargp);
+int doit(int clientfd, rio_t *clientriop);
+int client_ready(rio_t *clientriop);
+int send_stats(int clientfd, request_t *reqp);
 
 
 /*
- * main
+ * main - usage: proxy [-n threads] [-q queue depth] [-c client timeout]
+ *                    [-e] [-l loops] [-k] [-i max idle] [-t idle timeout]
+ *                    [-d cache dir] [-D cache MB] [-U] <port>
+ *        A fixed pool of worker threads serves connections taken from a
+ *        bounded queue. When the queue is full the acceptor blocks, so a
+ *        burst cannot create more than the configured number of threads.
+ *        With -e the proxy runs event-driven instead, on -l epoll loops
+ *        (one per core by default).
+ *        Workers close persistent client connections idle for -c seconds.
+ *        With -k the worker threads keep server connections alive and
+ *        share them through a pool holding up to -i idle connections per
+ *        origin for at most -t seconds.
+ *        With -d the worker threads also cache objects in segment files
+ *        in that directory, up to -D megabytes. Event mode has no disk
+ *        cache, so -d cannot be given with -e.
+ *        The acceptor and the worker threads each drive an io_uring
+ *        instance for accepting and for waiting on idle clients, unless
+ *        -U asks for plain system calls.
  */
 int main(int argc, char *argv[]) {
+    int listenfd, opt, i, n, optval = 1;
+    int connfds[ACCEPT_BATCH];
+    int nthreads = NTHREADS, sbufsize = SBUFSIZE;
+    int eventmode = 0, nloops = 0;
+    int maxidle = UPSTREAM_MAX_IDLE, idletimeout = UPSTREAM_IDLE_TIMEOUT;
+    int diskmax = DISK_CACHE_MAX;
+    char *port, *diskdir = NULL;
+    pthread_t tid;
     
     /* Check command argument */
-    if (argc != 2) {
-        printf("Command error. \n");
+    while ((opt = getopt(argc, argv, "n:q:c:el:ki:t:d:D:U")) != -1) {
+        switch (opt) {
+            case 'n':
+                nthreads = atoi(optarg);
+                break;
+            case 'q':
+                sbufsize = atoi(optarg);
+                break;
+            case 'c':
+                client_timeout = atoi(optarg);
+                break;
+            case 'e':
+                eventmode = 1;
+                break;
+            case 'l':
+                nloops = atoi(optarg);
+                break;
+            case 'k':
+                upstream_keepalive = 1;
+                break;
+            case 'i':
+                maxidle = atoi(optarg);
+                break;
+            case 't':
+                idletimeout = atoi(optarg);
+                break;
+            case 'd':
+                diskdir = optarg;
+                break;
+            case 'D':
+                diskmax = atoi(optarg);
+                break;
+            case 'U':
+                use_uring = 0;
+                break;
+            default:
+                nthreads = 0;
+                break;
+        }
+    }
+    if (optind != argc - 1 || nthreads <= 0 || sbufsize <= 0 || nloops < 0 ||
+        maxidle <= 0 || idletimeout < 0 || client_timeout < 0 || diskmax <= 0 ||
+        (eventmode && diskdir)) {
+        printf("usage: %s [-n threads] [-q queue depth] [-c client timeout] "
+               "[-e] [-l loops] [-k] [-i max idle] [-t idle timeout] "
+               "[-d cache dir] [-D cache MB] [-U] <port>\n", argv[0]);
         exit(1);
     }
-    int listenfd, clientlen, *connfd =0;
-    char *port;
-    struct sockaddr_in clientaddr;
-    pthread_t tid;
     
+    /* Writes to a vanished client must not kill the process */
+    Signal(SIGPIPE, SIG_IGN);
+    
+    cache_init();
+    stats_init();
+    port = argv[optind];
+    
+    /* Event-driven mode never returns. It does not pool connections. */
+    if (eventmode) {
+        upstream_keepalive = 0;
+        event_run(port, nloops);
+    }
+    upstream_init(maxidle, idletimeout);
+    flight_init();
+    if (diskdir && disk_cache_init(diskdir, (size_t)diskmax << 20) < 0) {
+        printf("Cannot use disk cache %s\n", diskdir);
+        exit(1);
+    }
     
     /* Open a listen port */
-    port = argv[1];
     if((listenfd = open_listenfd(port)) < 0) {
-        printf("Invalid port %s\n", argv[1]);
+        printf("Invalid port %s\n", port);
         exit(1);
     }
     
-    /* Create thread for each connection */
-    clientlen = sizeof(clientaddr);
+    /* Prethread the worker pool */
+    sbuf_init(&sbuf, sbufsize);
+    for (i = 0; i < nthreads; i++) {
+        Pthread_create(&tid, NULL, thread, NULL);
+    }
+    
+    /* Hand each connection to the pool, taking a burst of them with
+       one call. Responses are written in pieces, so Nagle would hold
+       the last one back for a delayed ACK */
+    if (use_uring) {
+        rio_uring_init(RIO_URING_ENTRIES);
+    }
     while (1) {
-        connfd = Malloc(sizeof(int));
-        if((*connfd = Accept(listenfd, (SA *)&clientaddr, (socklen_t *)&clientlen))>=0){
-            Pthread_create(&tid, NULL, doit, (void*)connfd);
+        if ((n = rio_acceptn(listenfd, connfds, ACCEPT_BATCH)) < 0) {
+            unix_error("Accept error");
         }
-        else{
-            printf("Accept socket error\n");
+        for (i = 0; i < n; i++) {
+            setsockopt(connfds[i], IPPROTO_TCP, TCP_NODELAY, &optval,
+                       sizeof(int));
+            sbuf_insert(&sbuf, connfds[i]);
         }
     }
     return 0;
 }
 
 /*
- * doit - Analyze the request from client.
- *       Send request to server and write response to client.
- *       This is the thread routine.
+ * thread - Worker routine. Serve connections from the queue forever,
+ *        one request after another while the client keeps it open.
  */
-
-void *doit(void *connfdp) {
+void *thread(void *vargp) {
     Pthread_detach(pthread_self());
-    char buf[MAXLINE],
-    method[MAXLINE], uri[MAXLINE], version[MAXLINE],
-    port[MAXLINE], host[MAXLINE], suffix[MAXLINE],
-    header[MAXLINE];
-    int clientfd = *(int *)connfdp;
-    int serverfd = 0;
-    long buflen = 0;
-    rio_t clientrio, serverrio;
-    
-    /* Read init */
-    Rio_readinitb(&clientrio, clientfd);
-    /* Check read from client */
-    if(Rio_readlineb(&clientrio, buf, MAXLINE)!=0){
-        sscanf(buf, "%s %s %s", method, uri, version);
-    }
-    else{
-        printf("Read error from client \n");
-    }
-    
-    
-    /* If the request method is GET */
-    if (!strcmp(method, "GET")) {
-        parse_uri(uri, host, port, suffix);
-        construct_header(&clientrio, header, host, suffix);
-        
-        /* Return error to client */
-        if ((serverfd = open_clientfd(host, port)) < 0) {
-            Rio_writen(clientfd, "Request eror\r\n", strlen("Request error\r\n"));
-            
-        }
-        /* Ask the server and write the response to client */
-        else{
-            Rio_readinitb(&serverrio, serverfd);
-            Rio_writen(serverfd, header, strlen(header));
-            while((buflen = Rio_readlineb(&serverrio, buf, MAXLINE)) != 0){
-                Rio_writen(clientfd, buf, buflen);
-            }
-        }
-        
-        Close(serverfd);
+    if (use_uring) {
+        rio_uring_init(RIO_URING_ENTRIES);
     }
-    else{
-        Rio_writen(clientfd, "Method not support\r\n", sizeof("Method not support\r\n"));
+    while (1) {
+        int clientfd = sbuf_remove(&sbuf);
+        char clientbuf[REQ_BUFSIZE];
+        rio_t clientrio;
+        
+        rio_readinitbuf(&clientrio, clientfd, clientbuf, REQ_BUFSIZE);
+        while (doit(clientfd, &clientrio) && client_ready(&clientrio))
+            ;
+        Close(clientfd);
     }
-    
-    Close(clientfd);
     return NULL;
 }
 
+/*
+ * client_ready - Wait for the next request on a persistent connection
+ *        and read what arrived. Pipelined requests may already be
+ *        buffered. Returns 0 if the client closed, failed, or stayed
+ *        idle for client_timeout seconds.
+ */
+int client_ready(rio_t *clientriop) {
+    return rio_fillb(clientriop, client_timeout * 1000) > 0;
+}
 
 /*
- * parse_uri - Parse the http uri in this format :
- *         http://www.cmu.edu:8080/cs/index.html
- *         The port is opotional.
+ * doit - Analyze the request from client.
+ *       Send request to server and write response to client.
+ *       The request header is parsed in place in clientriop's buffer,
+ *       and pipelined requests stay buffered there for the next call.
+ *       The caller closes clientfd.
  *
- *  Return 0 on success.
+ *  Return 1 if the client connection stays open for another request.
  */
-int parse_uri(char *uri, char *host, char *port, char *suffix)
-{
-    /* Check the uri starts with http:// */
-    if (strncasecmp(uri, "http://", 7)) {
-        return -1;
-    }
-    *port = 80;
-    
-    /* Try to find the host */
-    char *ptr = uri + 7;
-    while (*ptr != ':') {
-        *host = *ptr;
-        if (*ptr == '/') {
-            break;
+
+int doit(int clientfd, rio_t *clientriop) {
+    request_t req;
+    char host[MAXLINE], port[MAXLINE], key[MAXBUF], range[MAXLINE];
+    char object[MAX_OBJECT_SIZE], serverbuf[RELAY_CHUNK];
+    struct iovec iov[REQ_MAXIOV];
+    size_t objectlen = 0;
+    int serverfd = 0, reused = 0, rc, keepalive, clientflags, cacheable, iovcnt;
+    int ranged;
+    rio_t serverrio;
+    http_relay_t result;
+    disk_object_t stored;
+    flight_t *flight = NULL;
+    flight_reader_t reader;
+    unsigned long start, t;
+    
+    /* Check read from client. EOF just ends a persistent connection. */
+    start = stats_now();
+    if ((rc = request_read(clientriop, &req)) <= 0) {
+        if (rc < 0) {
+            http_send_error(clientfd, HTTP_BAD_REQUEST);
         }
-        host++;
-        ptr++;
-    }
-    *host = '\0';
-    
-    /* Try to find the port */
-    if (*ptr == ':') {
-        *ptr = '\0';
-        ptr++;
-        while (*ptr != '/') {
-            *port = *ptr;
-            ptr++;
-            port++;
+        return 0;
+    }
+    t = stats_time(STAGE_CLIENT_READ, start);
+    stats_count(COUNT_REQUESTS);
+    
+    /* Only GET is supported */
+    if (!span_eq(&req, req.method, "GET")) {
+        http_send_error(clientfd, HTTP_NOT_IMPLEMENTED);
+        return 0;
+    }
+    
+    /* Requests for our own statistics */
+    if (!req.host.len && req.path.len >= strlen(STATS_PATH) &&
+        !strncmp(SPAN_PTR(&req, req.path), STATS_PATH, strlen(STATS_PATH))) {
+        return send_stats(clientfd, &req);
+    }
+    
+    /* Where to send it */
+    if (span_copy(&req, req.host, host, MAXLINE) < 0 || !req.host.len ||
+        span_copy(&req, req.port, port, MAXLINE) < 0) {
+        http_send_error(clientfd, HTTP_BAD_REQUEST);
+        return 0;
+    }
+    if (!req.port.len) {
+        strcpy(port, "80");
+    }
+    t = stats_time(STAGE_PARSE, t);
+    
+    /* Persistent unless the client says otherwise */
+    keepalive = request_keepalive(&req);
+    clientflags = (keepalive ? HTTP_CLIENT_KEEPALIVE : 0) |
+                  (span_eq(&req, req.version, "HTTP/1.1") ?
+                   HTTP_CLIENT_CHUNKED : 0);
+    
+    /* Serve from cache if we can: memory first, then disk */
+    cacheable = snprintf(key, MAXBUF, "%s:%s%.*s", host, port,
+                         (int)req.path.len, SPAN_PTR(&req, req.path)) < MAXBUF;
+    
+    /* A Range request is cut from a cached copy when there is one, unless
+       If-Range makes it depend on a validator. Otherwise it goes to the
+       server as is, and the partial response is neither cached nor shared
+       with other requests for the object. */
+    ranged = req.rangehdr >= 0;
+    if (ranged && ((req.flags & REQ_IF_RANGE) ||
+                   span_copy(&req, req.headers[req.rangehdr].value, range,
+                             MAXLINE) < 0)) {
+        cacheable = 0;
+    }
+    rc = cacheable && cache_find(key, object, &objectlen);
+    if (!rc && cacheable && disk_cache_find(key, &stored)) {
+        stats_time(STAGE_CACHE, t);
+        stats_count(COUNT_DISK_HITS);
+        if (ranged) {
+            rc = http_send_range(clientfd, stored.data, stored.len, range,
+                                 keepalive);
         }
-        *port = '\0';
-        
+        else {
+            rc = http_send_stored(clientfd, stored.data, stored.len,
+                                  stored.hdrend, keepalive);
+        }
+        disk_cache_release(&stored);
+        stats_time(STAGE_TOTAL, start);
+        return !rc && keepalive;
     }
+    t = stats_time(STAGE_CACHE, t);
+    if (rc) {
+        stats_count(COUNT_CACHE_HITS);
+        if (ranged) {
+            rc = http_send_range(clientfd, object, objectlen, range, keepalive);
+        }
+        else {
+            rc = http_send_cached(clientfd, object, objectlen, keepalive);
+        }
+        stats_time(STAGE_TOTAL, start);
+        return !rc && keepalive;
+    }
+    stats_count(COUNT_CACHE_MISSES);
     
-    /* The remaining is suffix */
-    strcpy(suffix, ptr);
+    /* Follow a fetch of the same object already in progress */
+    if (cacheable && !ranged && flight_join(key, &flight, &reader) == FLIGHT_FOLLOWER) {
+        stats_count(COUNT_COALESCED);
+        rc = http_relay_flight(&reader, clientfd, clientflags, &result);
+        flight_leave(&reader);
+        if (rc == HTTP_RELAY_OK) {
+            stats_span(STAGE_FIRST_BYTE, t, result.firstbyte);
+            stats_time(STAGE_RELAY, result.firstbyte);
+            stats_time(STAGE_TOTAL, start);
+        }
+        if (rc != HTTP_RELAY_EMPTY) {
+            if (rc != HTTP_RELAY_OK) {
+                stats_count(COUNT_ERRORS);
+            }
+            return rc == HTTP_RELAY_OK && result.clientkeepalive;
+        }
+        /* The leader failed before its response started: try ourselves */
+        flight = NULL;
+    }
     
-    return 0;
-}
-
-
-
-/*
- * construct_requestLine - Construct the first line (request line)
- *               of a http message. GET is the one we support.
- */
-void construct_requestLine(char *requestLineBuf, char *suffix){
-    sprintf(requestLineBuf, "GET %s HTTP/1.0\r\n", suffix);
-}
-
-
-/* 
- * construct_messageHeader - Construct the header of a http message.
- *               The format can be found in global statics.
- *               In order to support HTTP 1.1, the "Host: xxx" is optional.
- */
- 
-void construct_messageHeader(char *messageHeaderBuf, rio_t *clientriop, char *host){
-    char host_buf[MAXLINE] ="";
-    char temp_buf[MAXLINE];
-    
-    /* Try to find host */
-    while (Rio_readlineb(clientriop,temp_buf,MAXLINE)>0) {
-        if (!strcmp(temp_buf, "\r\n")) {
-            break;
+    /* Reuse an idle server connection if we can */
+    if (upstream_keepalive && (serverfd = upstream_get(host, port)) >= 0) {
+        reused = 1;
+    }
+    /* Return error to client */
+    else if ((serverfd = open_clientfd(host, port)) < 0) {
+        stats_count(COUNT_ERRORS);
+        if (flight) {
+            flight_end(flight, 0);
+        }
+        http_send_error(clientfd, HTTP_BAD_GATEWAY);
+        return 0;
+    }
+    t = stats_time(STAGE_CONNECT, t);
+    
+    /* Ask the server and write the response to client. The request is
+       gathered from the client's buffer with one writev, as HTTP/1.1:
+       the relay decodes chunked replies, which end without closing the
+       connection. */
+    while (1) {
+        stats_count(reused ? COUNT_UPSTREAM_REUSED : COUNT_UPSTREAM_NEW);
+        rio_readinitbuf(&serverrio, serverfd, serverbuf, RELAY_CHUNK);
+        iovcnt = request_iov(&req, iov, REQ_OUT_HTTP11 |
+                             (upstream_keepalive ? REQ_OUT_KEEPALIVE : 0));
+        if (rio_writev(serverfd, iov, iovcnt) < 0) {
+            result.received = 0;
+            rc = HTTP_RELAY_EMPTY;
         }
-        if (!NOT_MATCH(temp_buf, "Host")) {
-            strcpy(host_buf, temp_buf);
+        else {
+            rc = http_relay_response(&serverrio, clientfd, clientflags,
+                                     cacheable && !ranged ? object : NULL,
+                                     MAX_OBJECT_SIZE, flight, &result);
         }
+        
+        /* The server may have closed a pooled connection meanwhile */
+        if (rc == HTTP_RELAY_EMPTY && reused) {
+            Close(serverfd);
+            reused = 0;
+            if ((serverfd = open_clientfd(host, port)) < 0) {
+                stats_count(COUNT_ERRORS);
+                if (flight) {
+                    flight_end(flight, 0);
+                }
+                http_send_error(clientfd, HTTP_BAD_GATEWAY);
+                return 0;
+            }
+            t = stats_now();
+            continue;
+        }
+        break;
     }
     
-    /* Host not found from request */
-    if (!strlen(host_buf)) {
-        sprintf(host_buf, "Host: %s\r\n", host);
+    if (rc == HTTP_RELAY_OK) {
+        stats_span(STAGE_FIRST_BYTE, t, result.firstbyte);
+        stats_time(STAGE_RELAY, result.firstbyte);
+        stats_time(STAGE_TOTAL, start);
+    }
+    else {
+        stats_count(COUNT_ERRORS);
+    }
+    /* Cache it before the flight ends, so later requests find it; a
+       response read for followers is good even if our client left */
+    if (result.received && result.copied) {
+        cache_insert(key, object, result.copylen);
+        disk_cache_insert(key, object, result.copylen);
     }
-    sprintf(messageHeaderBuf, "%s%s%s%s%s%s\r\n",
-            host_buf,
-            _userAgent,
-            _accept,
-            _acceptEncoding,
-            _connection,
-            _proxyConnection);
+    if (flight) {
+        flight_end(flight, result.received);
+    }
+    if (rc == HTTP_RELAY_OK && result.keepalive && upstream_keepalive) {
+        upstream_put(host, port, serverfd);
+    }
+    else {
+        Close(serverfd);
+    }
+    return rc == HTTP_RELAY_OK && result.clientkeepalive;
 }
 
-
 /*
- * construct_header - Construct the overall header of a http message.
- *          This function combines the above two construct functions.
+ * send_stats - Answer a request for STATS_PATH, sent straight to the
+ *        proxy, with the statistics of all threads.
  *
+ *  Return 1 if the client connection stays open.
  */
-void construct_header (rio_t *clientriop, char *header, char *host, char *suffix) {
-    
-    char requestLine_buf[MAXLINE];
-    construct_requestLine(requestLine_buf, suffix);
+int send_stats(int clientfd, request_t *reqp) {
+    char uri[MAXLINE], *response;
+    int keepalive;
+    size_t len;
+    ssize_t n;
     
-    char messsageHeader_buf[MAXLINE];
-    construct_messageHeader(messsageHeader_buf, clientriop,host);
+    keepalive = request_keepalive(reqp);
+    if (span_copy(reqp, reqp->path, uri, MAXLINE) < 0) {
+        uri[0] = '\0';
+    }
     
-    /* Combine requestLine and messageHeader */
-    sprintf(header, "%s%s", requestLine_buf, messsageHeader_buf);
-    return;
+    response = Malloc(STATS_MAXLEN + MAXLINE);
+    len = stats_response(response, STATS_MAXLEN + MAXLINE, uri, keepalive);
+    n = rio_writen(clientfd, response, len);
+    Free(response);
+    return n == len && keepalive;
 }
-
-
-
-
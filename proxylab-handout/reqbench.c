@@ -0,0 +1,257 @@
+/*
+ * reqbench.c - Microbenchmark of the proxy's request parsing.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ * Times reading and rewriting one browser-like request, from a rio
+ * buffer that already holds it (no system calls), with:
+ *
+ *   old      rio_readlineb + sscanf + parse_uri + construct_header, the
+ *            path the proxy used before request.c (copied below)
+ *   new      request_read + request_build (copy into one buffer)
+ *   iov      request_read + request_iov, what the proxy hands to writev
+ *   split    request_parse fed the header in two pieces, as when it
+ *            arrives in two reads, then request_build
+ *
+ * usage: reqbench [iterations] [-v]
+ */
+
+#include "csapp.h"
+#include "request.h"
+
+#define DEFAULT_ITERS 1000000
+
+static const char request[] =
+    "GET http://www.cmu.edu:8080/academics/index.html?lang=en HTTP/1.1\r\n"
+    "Host: www.cmu.edu:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Referer: http://www.cmu.edu:8080/\r\n"
+    "Cookie: session=8f14e45fceea167a5a36dedd4bea2543; theme=dark\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "Proxy-Connection: keep-alive\r\n"
+    "\r\n";
+
+static volatile size_t sink;    /* Keeps the work from being optimized away */
+
+static double now(void);
+static void fill(rio_t *rp);
+static void old_path(rio_t *rp, char *header);
+static void new_path(rio_t *rp, char *header);
+static void iov_path(rio_t *rp);
+static void split_path(char *header);
+
+
+int main(int argc, char **argv) {
+    char header[MAXBUF];
+    rio_t rio;
+    long i, iters = DEFAULT_ITERS;
+    int verbose = 0;
+    double t;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-v")) {
+            verbose = 1;
+        }
+        else {
+            iters = atol(argv[i]);
+        }
+    }
+
+    if (verbose) {
+        fill(&rio);
+        old_path(&rio, header);
+        printf("old:\n%s", header);
+        fill(&rio);
+        new_path(&rio, header);
+        printf("new:\n%s", header);
+    }
+
+    printf("%ld iterations, %zu byte request\n", iters, sizeof(request) - 1);
+
+    t = now();
+    for (i = 0; i < iters; i++) {
+        fill(&rio);
+        old_path(&rio, header);
+    }
+    printf("old    %7.1f ns/request\n", (now() - t) * 1e9 / iters);
+
+    t = now();
+    for (i = 0; i < iters; i++) {
+        fill(&rio);
+        new_path(&rio, header);
+    }
+    printf("new    %7.1f ns/request\n", (now() - t) * 1e9 / iters);
+
+    t = now();
+    for (i = 0; i < iters; i++) {
+        fill(&rio);
+        iov_path(&rio);
+    }
+    printf("iov    %7.1f ns/request\n", (now() - t) * 1e9 / iters);
+
+    t = now();
+    for (i = 0; i < iters; i++) {
+        split_path(header);
+    }
+    printf("split  %7.1f ns/request\n", (now() - t) * 1e9 / iters);
+    return 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * fill - Make rp hold the request as if it had just been read
+ */
+static void fill(rio_t *rp) {
+    rio_readinitb(rp, -1);
+    memcpy(rp->rio_buf, request, sizeof(request) - 1);
+    rp->rio_cnt = sizeof(request) - 1;
+}
+
+static void new_path(rio_t *rp, char *header) {
+    request_t req;
+    ssize_t n = 0;
+
+    if (request_read(rp, &req) <= 0 ||
+        (n = request_build(&req, header, MAXBUF - 1, REQ_OUT_KEEPALIVE)) < 0) {
+        app_error("new path failed");
+    }
+    header[n] = '\0';
+    sink += n;
+}
+
+static void iov_path(rio_t *rp) {
+    struct iovec iov[REQ_MAXIOV];
+    request_t req;
+    int n;
+
+    if (request_read(rp, &req) <= 0) {
+        app_error("iov path failed");
+    }
+    n = request_iov(&req, iov, REQ_OUT_KEEPALIVE);
+    sink += n + iov[n - 1].iov_len;
+}
+
+static void split_path(char *header) {
+    static char buf[sizeof(request)];
+    size_t half = (sizeof(request) - 1) / 2;
+    request_t req;
+    ssize_t n = 0;
+
+    memcpy(buf, request, half);
+    request_init(&req);
+    if (request_parse(&req, buf, half) != REQUEST_MORE) {
+        app_error("split path failed");
+    }
+    memcpy(buf + half, request + half, sizeof(request) - 1 - half);
+    if (request_parse(&req, buf, sizeof(request) - 1) != REQUEST_DONE ||
+        (n = request_build(&req, header, MAXBUF, REQ_OUT_KEEPALIVE)) < 0) {
+        app_error("split path failed");
+    }
+    sink += n;
+}
+
+
+/*
+ * The proxy's request handling before request.c, for comparison
+ */
+static const char *_userAgent = "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n";
+static const char *_accept = "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n";
+static const char *_acceptEncoding = "Accept-Encoding: gzip, deflate\r\n";
+static const char *_keepAlive = "Connection: keep-alive\r\n";
+
+static int parse_uri(char *uri, char *host, char *port, char *suffix) {
+    char *ptr;
+
+    if (strncasecmp(uri, "http://", 7)) {
+        return -1;
+    }
+    strcpy(port, "80");
+    ptr = uri + 7;
+    while (*ptr != ':') {
+        *host = *ptr;
+        if (*ptr == '/') {
+            break;
+        }
+        host++;
+        ptr++;
+    }
+    *host = '\0';
+    if (*ptr == ':') {
+        *ptr = '\0';
+        ptr++;
+        while (*ptr != '/') {
+            *port = *ptr;
+            ptr++;
+            port++;
+        }
+        *port = '\0';
+    }
+    strcpy(suffix, ptr);
+    return 0;
+}
+
+static int construct_header(rio_t *clientriop, char *header, char *host, char *suffix) {
+    char requestLine_buf[MAXLINE], messageHeader_buf[MAXLINE];
+    char host_buf[MAXLINE] = "", temp_buf[MAXLINE], *value;
+    int flags = 0;
+
+    sprintf(requestLine_buf, "GET %s HTTP/1.0\r\n", suffix);
+    while (rio_readlineb(clientriop, temp_buf, MAXLINE) > 0) {
+        if (!strcmp(temp_buf, "\r\n")) {
+            break;
+        }
+        if (!strncmp(temp_buf, "Host", 4)) {
+            strcpy(host_buf, temp_buf);
+        }
+        value = NULL;
+        if (!strncasecmp(temp_buf, "Connection:", 11)) {
+            value = temp_buf + 11;
+        }
+        else if (!strncasecmp(temp_buf, "Proxy-Connection:", 17)) {
+            value = temp_buf + 17;
+        }
+        else if (!strncasecmp(temp_buf, "Content-Length:", 15) ||
+                 !strncasecmp(temp_buf, "Transfer-Encoding:", 18)) {
+            flags |= REQ_HAS_BODY;
+        }
+        if (value) {
+            value += strspn(value, " \t");
+            if (!strncasecmp(value, "close", 5)) {
+                flags |= REQ_CONN_CLOSE;
+            }
+            else if (!strncasecmp(value, "keep-alive", 10)) {
+                flags |= REQ_CONN_KEEPALIVE;
+            }
+        }
+    }
+    if (!strlen(host_buf)) {
+        sprintf(host_buf, "Host: %s\r\n", host);
+    }
+    sprintf(messageHeader_buf, "%s%s%s%s%s\r\n", host_buf, _userAgent,
+            _accept, _acceptEncoding, _keepAlive);
+    sprintf(header, "%s%s", requestLine_buf, messageHeader_buf);
+    return flags;
+}
+
+static void old_path(rio_t *rp, char *header) {
+    char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
+    char host[MAXLINE], port[MAXLINE], suffix[MAXLINE];
+
+    if (rio_readlineb(rp, buf, MAXLINE) <= 0 ||
+        sscanf(buf, "%s %s %s", method, uri, version) != 3 ||
+        parse_uri(uri, host, port, suffix) < 0) {
+        app_error("old path failed");
+    }
+    sink += construct_header(rp, header, host, suffix);
+}
@@ -0,0 +1,415 @@
+/*
+ * request.c - Incremental, in-place HTTP request parser for the proxy.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ * request_parse tokenizes the request line and headers where they lie
+ * in the read buffer: every piece is a span (offset and length) into it,
+ * nothing is copied and nothing is allocated. It can be called again
+ * each time more bytes arrive; complete lines are never looked at twice,
+ * and the search for the end of a partial line resumes where it stopped.
+ * Spans are relative to the start of the request, so the caller may move
+ * the bytes (e.g. to make room for more) between calls.
+ *
+ * request_iov describes the request for the server as an iovec, to be
+ * sent with one writev: the request line with the path only (as HTTP/1.0,
+ * or HTTP/1.1 for a caller that can decode chunked replies), the
+ * client's headers as they were sent, except Host (added from the URI
+ * when missing), User-Agent (ours) and the hop-by-hop Connection,
+ * Proxy-Connection and Keep-Alive, and our own Connection header. The
+ * fixed parts are constant strings and the rest points into the read
+ * buffer, so nothing is formatted or copied; runs of forwarded header
+ * lines are contiguous there and take a single entry.
+ *
+ */
+
+#include <stddef.h>
+#include "request.h"
+
+static const char _userAgent[] = "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n";
+static const char _keepAlive[] = "Connection: keep-alive\r\n\r\n";
+static const char _close[] = "Connection: close\r\nProxy-Connection: close\r\n\r\n";
+
+/* Helpers */
+static span_t span(size_t off, size_t len);
+static int parse_request_line(request_t *rp, size_t start, size_t end);
+static int parse_header(request_t *rp, size_t start, size_t end, size_t next);
+static int has_token(request_t *rp, span_t s, const char *token);
+static void add(struct iovec *iov, int *np, const char *p, size_t n);
+
+
+/*
+ * request_init - Get ready to parse a new request
+ */
+void request_init(request_t *rp) {
+    memset(rp, 0, offsetof(request_t, headers));
+    rp->nheaders = 0;
+    rp->hosthdr = -1;
+    rp->rangehdr = -1;
+    rp->flags = 0;
+}
+
+/*
+ * request_parse - Parse the len bytes at buf, which start with the same
+ *          bytes as the previous call (if any) and may have more.
+ *
+ *  Return REQUEST_DONE once the blank line ending the header was seen
+ *  (rp->length bytes), REQUEST_MORE if it has not arrived yet, and
+ *  REQUEST_ERROR for a malformed request.
+ */
+int request_parse(request_t *rp, const char *buf, size_t len) {
+    const char *nl;
+    size_t end, next;
+
+    rp->base = buf;
+    while (rp->scan < len) {
+        if (!(nl = memchr(buf + rp->scan, '\n', len - rp->scan))) {
+            rp->scan = len;
+            break;
+        }
+        next = nl - buf + 1;
+        end = next - 1;
+        if (end > rp->pos && buf[end - 1] == '\r') {
+            end--;
+        }
+
+        if (rp->method.len == 0) {
+            /* Empty lines before the request line are ignored */
+            if (end > rp->pos && parse_request_line(rp, rp->pos, end) < 0) {
+                return REQUEST_ERROR;
+            }
+        }
+        else if (end == rp->pos) {
+            rp->length = next;
+            rp->pos = rp->scan = next;
+            return REQUEST_DONE;
+        }
+        else if (parse_header(rp, rp->pos, end, next) < 0) {
+            return REQUEST_ERROR;
+        }
+        rp->pos = rp->scan = next;
+    }
+    return REQUEST_MORE;
+}
+
+/*
+ * request_read - Read and parse one request header from riop, in riop's
+ *          own buffer. A header split across reads is moved to the
+ *          front of the buffer so the rest can be read after it. The
+ *          spans stay valid until the next read from riop; bytes after
+ *          the header (a pipelined request) stay buffered.
+ *
+ *  Return 1 on success, 0 on EOF before any byte of a request, -1 on
+ *  error (including a header too large for the buffer). On a
+ *  non-blocking descriptor, REQUEST_AGAIN means the rest has not arrived
+ *  yet: the bytes so far stay buffered, so call again once it has.
+ */
+int request_read(rio_t *riop, request_t *rp) {
+    ssize_t n;
+    int rc;
+
+    request_init(rp);
+    while ((rc = request_parse(rp, riop->rio_bufptr, riop->rio_cnt)) == REQUEST_MORE) {
+        if (riop->rio_bufptr != riop->rio_buf) {
+            memmove(riop->rio_buf, riop->rio_bufptr, riop->rio_cnt);
+            riop->rio_bufptr = riop->rio_buf;
+        }
+        if (riop->rio_cnt == riop->rio_bufsize) {
+            return -1;
+        }
+        n = read(riop->rio_fd, riop->rio_buf + riop->rio_cnt,
+                 riop->rio_bufsize - riop->rio_cnt);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return REQUEST_AGAIN;
+        }
+        if (n <= 0) {
+            return n == 0 && riop->rio_cnt == 0 ? 0 : -1;
+        }
+        riop->rio_cnt += n;
+    }
+    if (rc == REQUEST_ERROR) {
+        return -1;
+    }
+    riop->rio_bufptr += rp->length;
+    riop->rio_cnt -= rp->length;
+    return 1;
+}
+
+/*
+ * request_keepalive - May the client connection stay open after the
+ *          response? Only if the client did not ask to close it and asked
+ *          to keep it (or speaks HTTP/1.1). Request bodies are not
+ *          supported, so a request with one ends the connection.
+ */
+int request_keepalive(request_t *rp) {
+    return !(rp->flags & (REQ_CONN_CLOSE | REQ_HAS_BODY)) &&
+           ((rp->flags & REQ_CONN_KEEPALIVE) ||
+            span_eq(rp, rp->version, "HTTP/1.1"));
+}
+
+/*
+ * span_eq - Does span s hold str (ignoring case)?
+ */
+int span_eq(request_t *rp, span_t s, const char *str) {
+    return s.len == strlen(str) && !strncasecmp(SPAN_PTR(rp, s), str, s.len);
+}
+
+/*
+ * span_copy - Copy span s into dst as a string, for functions that need
+ *          one. Returns -1 if it does not fit in size bytes.
+ */
+int span_copy(request_t *rp, span_t s, char *dst, size_t size) {
+    if (s.len >= size) {
+        return -1;
+    }
+    memcpy(dst, SPAN_PTR(rp, s), s.len);
+    dst[s.len] = '\0';
+    return 0;
+}
+
+/*
+ * request_iov - Describe the request for the server as iov entries:
+ *          constant strings and pieces of the client's request, which
+ *          must stay in place until it is written. iov needs room for
+ *          REQ_MAXIOV entries. outflags are REQ_OUT_*.
+ *
+ *  Return the number of entries used.
+ */
+int request_iov(request_t *rp, struct iovec *iov, int outflags) {
+    req_header_t *hp;
+    int i, n = 0;
+
+    add(iov, &n, "GET ", 4);
+    if (rp->path.len) {
+        add(iov, &n, SPAN_PTR(rp, rp->path), rp->path.len);
+    }
+    else {
+        add(iov, &n, "/", 1);
+    }
+    if (outflags & REQ_OUT_HTTP11) {
+        add(iov, &n, " HTTP/1.1\r\n", 11);
+    }
+    else {
+        add(iov, &n, " HTTP/1.0\r\n", 11);
+    }
+
+    if (rp->hosthdr >= 0) {
+        hp = &rp->headers[rp->hosthdr];
+        add(iov, &n, SPAN_PTR(rp, hp->line), hp->line.len);
+    }
+    else {
+        add(iov, &n, "Host: ", 6);
+        add(iov, &n, SPAN_PTR(rp, rp->host), rp->host.len);
+        if (rp->port.len) {
+            add(iov, &n, ":", 1);
+            add(iov, &n, SPAN_PTR(rp, rp->port), rp->port.len);
+        }
+        add(iov, &n, "\r\n", 2);
+    }
+    add(iov, &n, _userAgent, sizeof(_userAgent) - 1);
+
+    for (i = 0; i < rp->nheaders; i++) {
+        hp = &rp->headers[i];
+        if (i == rp->hosthdr ||
+            span_eq(rp, hp->name, "User-Agent") ||
+            span_eq(rp, hp->name, "Connection") ||
+            span_eq(rp, hp->name, "Proxy-Connection") ||
+            span_eq(rp, hp->name, "Keep-Alive")) {
+            continue;
+        }
+        add(iov, &n, SPAN_PTR(rp, hp->line), hp->line.len);
+    }
+
+    if (outflags & REQ_OUT_KEEPALIVE) {
+        add(iov, &n, _keepAlive, sizeof(_keepAlive) - 1);
+    }
+    else {
+        add(iov, &n, _close, sizeof(_close) - 1);
+    }
+    return n;
+}
+
+/*
+ * request_build - Write the request for the server into buf, as
+ *          request_iov describes it with outflags.
+ *
+ *  Return its length, or -1 if it does not fit in size bytes.
+ */
+ssize_t request_build(request_t *rp, char *buf, size_t size, int outflags) {
+    struct iovec iov[REQ_MAXIOV];
+    size_t len = 0;
+    int i, n;
+
+    n = request_iov(rp, iov, outflags);
+    for (i = 0; i < n; i++) {
+        if (len + iov[i].iov_len > size) {
+            return -1;
+        }
+        memcpy(buf + len, iov[i].iov_base, iov[i].iov_len);
+        len += iov[i].iov_len;
+    }
+    return len;
+}
+
+static span_t span(size_t off, size_t len) {
+    span_t s;
+
+    s.off = off;
+    s.len = len;
+    return s;
+}
+
+/*
+ * parse_request_line - Split "METHOD URI VERSION", and an absolute URI
+ *          (http://host[:port][/path]) into its parts.
+ */
+static int parse_request_line(request_t *rp, size_t start, size_t end) {
+    const char *b = rp->base;
+    size_t i = start, uri, h, p, e;
+
+    while (i < end && b[i] != ' ') {
+        i++;
+    }
+    if (i == start || i == end) {
+        return -1;
+    }
+    rp->method = span(start, i - start);
+
+    uri = ++i;
+    while (i < end && b[i] != ' ') {
+        i++;
+    }
+    if (i == uri || i + 1 >= end) {
+        return -1;
+    }
+    rp->uri = span(uri, i - uri);
+    rp->version = span(i + 1, end - i - 1);
+
+    if (rp->uri.len < 7 || strncasecmp(b + uri, "http://", 7)) {
+        rp->path = rp->uri;
+        return 0;
+    }
+    e = uri + rp->uri.len;
+    i = h = uri + 7;
+    while (i < e && b[i] != ':' && b[i] != '/') {
+        i++;
+    }
+    if (i == h) {
+        return -1;
+    }
+    rp->host = span(h, i - h);
+    if (i < e && b[i] == ':') {
+        p = ++i;
+        while (i < e && b[i] != '/') {
+            i++;
+        }
+        rp->port = span(p, i - p);
+    }
+    rp->path = span(i, e - i);
+    return 0;
+}
+
+/*
+ * parse_header - Split "Name: value" and note the headers that matter
+ *          to the proxy.
+ */
+static int parse_header(request_t *rp, size_t start, size_t end, size_t next) {
+    const char *b = rp->base;
+    req_header_t *hp;
+    size_t colon = start, v, ve;
+
+    /* Obsolete line folding is not supported */
+    if (rp->nheaders == REQ_MAXHEADERS || b[start] == ' ' || b[start] == '\t') {
+        return -1;
+    }
+    while (colon < end && b[colon] != ':') {
+        colon++;
+    }
+    if (colon == start || colon == end) {
+        return -1;
+    }
+    v = colon + 1;
+    while (v < end && (b[v] == ' ' || b[v] == '\t')) {
+        v++;
+    }
+    ve = end;
+    while (ve > v && (b[ve - 1] == ' ' || b[ve - 1] == '\t')) {
+        ve--;
+    }
+
+    hp = &rp->headers[rp->nheaders];
+    hp->name = span(start, colon - start);
+    hp->value = span(v, ve - v);
+    hp->line = span(start, next - start);
+
+    if (span_eq(rp, hp->name, "Host")) {
+        rp->hosthdr = rp->nheaders;
+    }
+    else if (span_eq(rp, hp->name, "Range")) {
+        rp->rangehdr = rp->nheaders;
+    }
+    else if (span_eq(rp, hp->name, "If-Range")) {
+        rp->flags |= REQ_IF_RANGE;
+    }
+    else if (span_eq(rp, hp->name, "Connection") ||
+             span_eq(rp, hp->name, "Proxy-Connection")) {
+        if (has_token(rp, hp->value, "close")) {
+            rp->flags |= REQ_CONN_CLOSE;
+        }
+        else if (has_token(rp, hp->value, "keep-alive")) {
+            rp->flags |= REQ_CONN_KEEPALIVE;
+        }
+    }
+    else if ((span_eq(rp, hp->name, "Content-Length") &&
+              !span_eq(rp, hp->value, "0")) ||
+             span_eq(rp, hp->name, "Transfer-Encoding")) {
+        rp->flags |= REQ_HAS_BODY;
+    }
+    rp->nheaders++;
+    return 0;
+}
+
+/*
+ * has_token - Is token one of the comma-separated items of s?
+ */
+static int has_token(request_t *rp, span_t s, const char *token) {
+    const char *p = SPAN_PTR(rp, s), *e = p + s.len, *t;
+    size_t len = strlen(token);
+
+    while (p < e) {
+        while (p < e && (*p == ' ' || *p == '\t' || *p == ',')) {
+            p++;
+        }
+        t = p;
+        while (p < e && *p != ',' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+        if (p - t == len && !strncasecmp(t, token, len)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * add - Append n bytes at p to iov, extending the last entry when p
+ *          follows it (consecutive forwarded header lines)
+ */
+static void add(struct iovec *iov, int *np, const char *p, size_t n) {
+    struct iovec *last;
+
+    if (*np > 0) {
+        last = &iov[*np - 1];
+        if ((char *)last->iov_base + last->iov_len == p) {
+            last->iov_len += n;
+            return;
+        }
+    }
+    iov[*np].iov_base = (void *)p;
+    iov[*np].iov_len = n;
+    (*np)++;
+}
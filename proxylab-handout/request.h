@@ -0,0 +1,80 @@
+/*
+ * request.h - Incremental, in-place HTTP request parser for the proxy.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ */
+#ifndef __REQUEST_H__
+#define __REQUEST_H__
+
+#include "csapp.h"
+
+#define REQ_MAXHEADERS 64
+#define REQ_MAXIOV (REQ_MAXHEADERS + 10)  /* Entries request_iov may use */
+#define REQ_BUFSIZE (16 * 1024)  /* Client read buffer; bounds the header */
+
+/* Flags in request_t about the client's request */
+#define REQ_CONN_CLOSE     0x1  /* Connection: close */
+#define REQ_CONN_KEEPALIVE 0x2  /* (Proxy-)Connection: keep-alive */
+#define REQ_HAS_BODY       0x4  /* Content-Length or Transfer-Encoding */
+#define REQ_IF_RANGE       0x8  /* If-Range: the Range depends on a validator */
+
+/* request_iov flags for the request sent to the server */
+#define REQ_OUT_KEEPALIVE  0x1  /* Ask to keep the connection open */
+#define REQ_OUT_HTTP11     0x2  /* HTTP/1.1, so the reply may be chunked */
+
+/* request_parse return values */
+#define REQUEST_DONE   1        /* Whole header parsed */
+#define REQUEST_MORE   0        /* Need more bytes */
+#define REQUEST_ERROR  -1       /* Malformed or too many headers */
+
+/* request_read return value when a non-blocking descriptor has no more
+   bytes yet */
+#define REQUEST_AGAIN  -2
+
+/* A piece of the request, as an offset into the parsed buffer so it
+   survives the buffer being moved */
+typedef struct {
+    size_t off;
+    size_t len;
+} span_t;
+
+typedef struct {
+    span_t name;
+    span_t value;
+    span_t line;        /* Whole line, including its line ending */
+} req_header_t;
+
+typedef struct {
+    /* Parser state */
+    const char *base;   /* Buffer of the last request_parse call */
+    size_t pos;         /* Start of the first line not parsed yet */
+    size_t scan;        /* Where to resume looking for its end */
+    size_t length;      /* Bytes in the whole header, once done */
+
+    /* Request line; host, port and path come from an absolute URI
+       (host.len is 0 for an origin-form URI like "/x") */
+    span_t method, uri, version;
+    span_t host, port, path;
+
+    req_header_t headers[REQ_MAXHEADERS];
+    int nheaders;
+    int hosthdr;        /* Index of the Host header, -1 if none */
+    int rangehdr;       /* Index of the Range header, -1 if none */
+    int flags;          /* REQ_* */
+} request_t;
+
+/* Start of a span; only valid until the buffer changes */
+#define SPAN_PTR(rp, s) ((rp)->base + (s).off)
+
+void request_init(request_t *rp);
+int request_parse(request_t *rp, const char *buf, size_t len);
+int request_read(rio_t *riop, request_t *rp);
+int request_keepalive(request_t *rp);
+int span_eq(request_t *rp, span_t s, const char *str);
+int span_copy(request_t *rp, span_t s, char *dst, size_t size);
+int request_iov(request_t *rp, struct iovec *iov, int outflags);
+ssize_t request_build(request_t *rp, char *buf, size_t size, int outflags);
+
+#endif /* __REQUEST_H__ */
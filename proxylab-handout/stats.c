@@ -0,0 +1,293 @@
+/*
+ * stats.c - Per-thread counters and latency histograms for the proxy.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ * Every thread that records something gets its own block of counters
+ * and histograms, so recording is a few plain stores to memory no other
+ * thread writes: no locks, no atomic read-modify-write, no shared cache
+ * lines. The blocks are linked into a global list (under a semaphore,
+ * once per thread) and stats_render adds them all up. Its reads race
+ * with the writers, so a report may be a few events behind, but every
+ * word it reads is a value some thread really stored.
+ *
+ */
+
+#include "stats.h"
+
+/* One stage's latencies, in microseconds */
+typedef struct {
+    unsigned long count;
+    unsigned long sum;
+    unsigned long max;
+    unsigned long hist[STATS_HIST_BUCKETS];
+} stage_hist_t;
+
+/* Everything one thread recorded */
+typedef struct stats_block {
+    unsigned long counters[NCOUNTERS];
+    stage_hist_t stages[NSTAGES];
+    struct stats_block *next;
+} stats_block_t;
+
+static const char *stage_names[NSTAGES] = {
+    "client_read", "parse", "cache", "connect", "first_byte", "relay", "total"
+};
+static const char *counter_names[NCOUNTERS] = {
+    "requests", "cache_hits", "cache_misses", "disk_hits", "upstream_new",
+    "upstream_reused", "coalesced", "errors"
+};
+
+static stats_block_t *blocks = NULL;
+static __thread stats_block_t *mine = NULL;
+static unsigned long started;
+static sem_t mutex;
+
+/* Helpers */
+static stats_block_t *my_block(void);
+static void add(unsigned long *word, unsigned long n);
+static unsigned long get(unsigned long *word);
+static unsigned long percentile(stage_hist_t *sp, double pct);
+
+
+/*
+ * stats_init - Start the clock. Must run before any other call.
+ */
+void stats_init(void) {
+    Sem_init(&mutex, 0, 1);
+    started = stats_now();
+}
+
+/*
+ * stats_now - Monotonic time in nanoseconds
+ */
+unsigned long stats_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/*
+ * stats_count - Count one event
+ */
+void stats_count(stats_counter_t counter) {
+    stats_block_t *bp = my_block();
+
+    add(&bp->counters[counter], 1);
+}
+
+/*
+ * stats_time - Record that stage took from start (a stats_now value)
+ *          until now. Returns now, to start timing the next stage.
+ */
+unsigned long stats_time(stats_stage_t stage, unsigned long start) {
+    unsigned long now = stats_now();
+
+    stats_span(stage, start, now);
+    return now;
+}
+
+/*
+ * stats_span - Record that stage took from start until end
+ */
+void stats_span(stats_stage_t stage, unsigned long start, unsigned long end) {
+    stage_hist_t *sp = &my_block()->stages[stage];
+    unsigned long us = (end - start) / 1000;
+
+    add(&sp->hist[stats_hist_index(us)], 1);
+    add(&sp->sum, us);
+    if (us > sp->max) {
+        __atomic_store_n(&sp->max, us, __ATOMIC_RELAXED);
+    }
+    add(&sp->count, 1);
+}
+
+/*
+ * stats_render - Write a report of all threads' statistics to buf, as
+ *          JSON if json is set, plain text otherwise.
+ *
+ *  Return the length of the report (truncated to fit size).
+ */
+size_t stats_render(char *buf, size_t size, int json) {
+    unsigned long counters[NCOUNTERS] = {0};
+    stage_hist_t *total = Calloc(NSTAGES, sizeof(stage_hist_t));
+    stats_block_t *bp;
+    stage_hist_t *sp;
+    dns_stats_t dns;
+    size_t len = 0;
+    int i, b;
+
+    /* Add up every thread's block */
+    P(&mutex);
+    for (bp = blocks; bp; bp = bp->next) {
+        for (i = 0; i < NCOUNTERS; i++) {
+            counters[i] += get(&bp->counters[i]);
+        }
+        for (i = 0; i < NSTAGES; i++) {
+            total[i].count += get(&bp->stages[i].count);
+            total[i].sum += get(&bp->stages[i].sum);
+            if (get(&bp->stages[i].max) > total[i].max) {
+                total[i].max = get(&bp->stages[i].max);
+            }
+            for (b = 0; b < STATS_HIST_BUCKETS; b++) {
+                total[i].hist[b] += get(&bp->stages[i].hist[b]);
+            }
+        }
+    }
+    V(&mutex);
+    dns_cache_stats(&dns);
+
+#define OUT(...) \
+    (len += snprintf(buf + len, len < size ? size - len : 0, __VA_ARGS__))
+
+    if (json) {
+        OUT("{\"uptime_s\":%lu,\"counters\":{",
+            (stats_now() - started) / 1000000000UL);
+        for (i = 0; i < NCOUNTERS; i++) {
+            OUT("%s\"%s\":%lu", i ? "," : "", counter_names[i], counters[i]);
+        }
+        OUT("},\"dns\":{\"hits\":%lu,\"neg_hits\":%lu,\"misses\":%lu},"
+            "\"stages_us\":{", dns.hits, dns.neg_hits, dns.misses);
+        for (i = 0; i < NSTAGES; i++) {
+            sp = &total[i];
+            OUT("%s\"%s\":{\"count\":%lu,\"mean\":%lu,\"p50\":%lu,\"p90\":%lu,"
+                "\"p99\":%lu,\"p999\":%lu,\"max\":%lu}", i ? "," : "",
+                stage_names[i], sp->count, sp->count ? sp->sum / sp->count : 0,
+                percentile(sp, 0.50), percentile(sp, 0.90),
+                percentile(sp, 0.99), percentile(sp, 0.999), sp->max);
+        }
+        OUT("}}\n");
+    }
+    else {
+        OUT("uptime_s %lu\n", (stats_now() - started) / 1000000000UL);
+        for (i = 0; i < NCOUNTERS; i++) {
+            OUT("%-16s %lu\n", counter_names[i], counters[i]);
+        }
+        OUT("%-16s %lu\n%-16s %lu\n%-16s %lu\n\n", "dns_hits", dns.hits,
+            "dns_neg_hits", dns.neg_hits, "dns_misses", dns.misses);
+        OUT("%-12s %10s %8s %8s %8s %8s %8s %8s   (us)\n", "stage", "count",
+            "mean", "p50", "p90", "p99", "p999", "max");
+        for (i = 0; i < NSTAGES; i++) {
+            sp = &total[i];
+            OUT("%-12s %10lu %8lu %8lu %8lu %8lu %8lu %8lu\n", stage_names[i],
+                sp->count, sp->count ? sp->sum / sp->count : 0,
+                percentile(sp, 0.50), percentile(sp, 0.90),
+                percentile(sp, 0.99), percentile(sp, 0.999), sp->max);
+        }
+    }
+#undef OUT
+
+    Free(total);
+    return len < size ? len : size - 1;
+}
+
+/*
+ * stats_response - Build the whole HTTP response to a request for uri
+ *          (STATS_PATH, with "format=json" in the query for JSON).
+ *
+ *  Return its length.
+ */
+size_t stats_response(char *buf, size_t size, char *uri, int keepalive) {
+    char *body = Malloc(STATS_MAXLEN);
+    int json = strstr(uri, "format=json") != NULL;
+    size_t bodylen, len;
+
+    bodylen = stats_render(body, STATS_MAXLEN, json);
+    len = snprintf(buf, size, "HTTP/1.0 200 OK\r\n"
+                   "Content-Type: %s\r\n"
+                   "Content-Length: %zu\r\n"
+                   "Cache-Control: no-store\r\n"
+                   "Connection: %s\r\n\r\n",
+                   json ? "application/json" : "text/plain", bodylen,
+                   keepalive ? "keep-alive" : "close");
+    if (len + bodylen > size) {
+        bodylen = len < size ? size - len : 0;
+    }
+    memcpy(buf + len, body, bodylen);
+    Free(body);
+    return len + bodylen;
+}
+
+/*
+ * stats_hist_index - Histogram bucket of a value in microseconds. An
+ *          octave shifted right by s lands in [SUB*(s+1), SUB*(s+2)).
+ */
+int stats_hist_index(unsigned long us) {
+    int shift;
+
+    if (us < 2 * STATS_HIST_SUB) {
+        return us;
+    }
+    shift = 63 - __builtin_clzl(us) - STATS_HIST_SUB_BITS;
+    if (shift >= STATS_HIST_BUCKETS / STATS_HIST_SUB - 1) {
+        return STATS_HIST_BUCKETS - 1;
+    }
+    return STATS_HIST_SUB * shift + (us >> shift);
+}
+
+/*
+ * stats_hist_value - Largest value that falls into bucket idx
+ */
+unsigned long stats_hist_value(int idx) {
+    int shift;
+
+    if (idx < 2 * STATS_HIST_SUB) {
+        return idx;
+    }
+    shift = idx / STATS_HIST_SUB - 1;
+    return ((unsigned long)(idx - STATS_HIST_SUB * shift + 1) << shift) - 1;
+}
+
+
+/*
+ * my_block - This thread's block, created and linked in on first use
+ */
+static stats_block_t *my_block(void) {
+    if (!mine) {
+        mine = Calloc(1, sizeof(stats_block_t));
+        P(&mutex);
+        mine->next = blocks;
+        blocks = mine;
+        V(&mutex);
+    }
+    return mine;
+}
+
+/*
+ * add - Add n to a word only this thread writes. A relaxed load and
+ *          store cannot tear, which is all a concurrent reader needs.
+ */
+static void add(unsigned long *word, unsigned long n) {
+    __atomic_store_n(word, __atomic_load_n(word, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);
+}
+
+/*
+ * get - Read a word another thread may be writing
+ */
+static unsigned long get(unsigned long *word) {
+    return __atomic_load_n(word, __ATOMIC_RELAXED);
+}
+
+/*
+ * percentile - Smallest latency that pct of the samples did not exceed
+ */
+static unsigned long percentile(stage_hist_t *sp, double pct) {
+    unsigned long seen = 0, want = (unsigned long)(sp->count * pct);
+    int i;
+
+    if (sp->count == 0) {
+        return 0;
+    }
+    if (want < sp->count * pct || want == 0) {
+        want++;     /* Round up, or 4 samples would give p99 the 3rd */
+    }
+    for (i = 0; i < STATS_HIST_BUCKETS; i++) {
+        if ((seen += sp->hist[i]) >= want) {
+            return stats_hist_value(i) < sp->max ? stats_hist_value(i) : sp->max;
+        }
+    }
+    return sp->max;
+}
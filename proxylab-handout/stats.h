@@ -0,0 +1,60 @@
+/*
+ * stats.h - Per-thread counters and latency histograms for the proxy.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ */
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include "csapp.h"
+
+/* URL that returns the statistics instead of being proxied; add
+   "?format=json" for JSON */
+#define STATS_PATH "/__proxy_stats"
+#define STATS_MAXLEN (16 * 1024)    /* Room for a whole stats response */
+
+/* Log-linear histogram of microseconds: exact below 2*SUB, then SUB
+   buckets per power of two (about 3% precision), up to 2^41 us */
+#define STATS_HIST_SUB_BITS 5
+#define STATS_HIST_SUB (1 << STATS_HIST_SUB_BITS)
+#define STATS_HIST_BUCKETS (STATS_HIST_SUB * 42)
+
+/* Request stages, each with its own latency histogram */
+typedef enum {
+    STAGE_CLIENT_READ,  /* Request header from the client, parsed */
+    STAGE_PARSE,        /* Checking the request and where it goes */
+    STAGE_CACHE,        /* Cache lookup */
+    STAGE_CONNECT,      /* DNS and connect, or taking a pooled connection */
+    STAGE_FIRST_BYTE,   /* Request sent until the response starts */
+    STAGE_RELAY,        /* Rest of the response to the client */
+    STAGE_TOTAL,        /* Whole request */
+    NSTAGES
+} stats_stage_t;
+
+/* Event counters */
+typedef enum {
+    COUNT_REQUESTS,
+    COUNT_CACHE_HITS,
+    COUNT_CACHE_MISSES,     /* Missed both caches */
+    COUNT_DISK_HITS,
+    COUNT_UPSTREAM_NEW,     /* Requests on a new server connection */
+    COUNT_UPSTREAM_REUSED,  /* Requests on a pooled server connection */
+    COUNT_COALESCED,        /* Misses that followed another's fetch */
+    COUNT_ERRORS,
+    NCOUNTERS
+} stats_counter_t;
+
+void stats_init(void);
+unsigned long stats_now(void);
+void stats_count(stats_counter_t counter);
+unsigned long stats_time(stats_stage_t stage, unsigned long start);
+void stats_span(stats_stage_t stage, unsigned long start, unsigned long end);
+size_t stats_render(char *buf, size_t size, int json);
+size_t stats_response(char *buf, size_t size, char *uri, int keepalive);
+
+int stats_hist_index(unsigned long us);
+unsigned long stats_hist_value(int idx);
+
+#endif /* __STATS_H__ */
@@ -21,6 +21,7 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -43,10 +44,20 @@ typedef struct {
     int rio_fd;                /* Descriptor for this internal buf */
     int rio_cnt;               /* Unread bytes in internal buf */
     char *rio_bufptr;          /* Next unread byte in internal buf */
-    char rio_buf[RIO_BUFSIZE]; /* Internal buffer */
+    char *rio_buf;             /* Internal buffer: rio_defbuf or the caller's */
+    size_t rio_bufsize;        /* Size of rio_buf */
+    char rio_defbuf[RIO_BUFSIZE]; /* Default internal buffer */
 } rio_t;
 /* $end rio_t */
 
+/* Persistent state for the buffered Rio writer */
+typedef struct {
+    int rio_fd;                /* Descriptor written to */
+    size_t rio_cnt;            /* Bytes waiting in rio_buf */
+    size_t rio_bufsize;        /* Size of rio_buf */
+    char *rio_buf;             /* Caller's buffer */
+} rio_wbuf_t;
+
 /* External variables */
 extern int h_errno;    /* Defined by BIND for DNS errors */ 
 extern char **environ; /* Defined by libc */
@@ -171,9 +182,14 @@ void V(sem_t *sem);
 /* Rio (Robust I/O) package */
 ssize_t rio_readn(int fd, void *usrbuf, size_t n);
 ssize_t rio_writen(int fd, void *usrbuf, size_t n);
+ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt);
 void rio_readinitb(rio_t *rp, int fd); 
+void rio_readinitbuf(rio_t *rp, int fd, char *buf, size_t size);
 ssize_t	rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t	rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+void rio_writeinitb(rio_wbuf_t *wp, int fd, char *buf, size_t size);
+ssize_t rio_writeb(rio_wbuf_t *wp, void *usrbuf, size_t n);
+ssize_t rio_flush(rio_wbuf_t *wp);
 
 /* Wrappers for Rio package */
 ssize_t Rio_readn(int fd, void *usrbuf, size_t n);
@@ -182,6 +198,25 @@ void Rio_readinitb(rio_t *rp, int fd);
 ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
 
+/* io_uring backend for Rio: one ring per thread, falling back to plain
+   system calls where io_uring is not available */
+#define RIO_URING_ENTRIES 64    /* Default ring size */
+#define RIO_URING_LINK    0x1   /* Start the next request only once this
+                                   one fully succeeded */
+#define RIO_URING_TAG_MIN (~0UL - 2)  /* Tags from here on are ours */
+int rio_uring_init(unsigned entries);
+void rio_uring_exit(void);
+int rio_uring_active(void);
+int rio_uring_read(int fd, void *usrbuf, size_t n, unsigned long tag, int flags);
+int rio_uring_writev(int fd, struct iovec *iov, int iovcnt, unsigned long tag,
+                     int flags);
+int rio_uring_accept(int listenfd, unsigned long tag, int flags);
+int rio_uring_timeout(int ms);
+int rio_uring_submit(unsigned waitnr);
+int rio_uring_reap(unsigned long *tagp, int *resp);
+ssize_t rio_fillb(rio_t *rp, int ms);
+int rio_acceptn(int listenfd, int *fds, int max);
+
 /* Reentrant protocol-independent client/server helpers */
 int open_clientfd(char *hostname, char *port);
 int open_listenfd(char *port);
@@ -0,0 +1,187 @@
+/*
+ * filecache.c - Cache of open descriptors for the files tiny serves
+ *
+ *     doit() already stats every requested file, so the cache keys open
+ *     descriptors by path and checks them against that stat: an entry
+ *     whose inode, size or mtime differs is dropped and the file is
+ *     opened again. A hot file therefore costs one stat() and one
+ *     sendfile() per request, with no open/mmap/munmap/close.
+ *
+ *     Entries are reference counted so a descriptor is never closed
+ *     while a request is still sending from it. When the cache is full,
+ *     the least recently used idle entry is closed.
+ */
+#include "filecache.h"
+
+#define FILECACHE_BUCKETS 256  /* Hash buckets (power of two) */
+
+static fc_file_t *buckets[FILECACHE_BUCKETS];
+static int maxfiles = FILECACHE_MAX;
+static int nfiles;
+static unsigned long tick;
+static sem_t mutex;
+
+static unsigned int hash(char *s);
+static int is_current(fc_file_t *fp, struct stat *sbufp);
+static void unlink_file(fc_file_t *fp);
+static void evict_one(void);
+static void destroy(fc_file_t *fp);
+
+/*
+ * filecache_init - Keep at most max files open. Must run before any
+ *     other call.
+ */
+void filecache_init(int max)
+{
+    maxfiles = max;
+    nfiles = 0;
+    tick = 0;
+    memset(buckets, 0, sizeof(buckets));
+    Sem_init(&mutex, 0, 1);
+}
+
+/*
+ * filecache_get - Return an open descriptor for filename, which the
+ *     caller has just stat'ed into *sbufp. Returns NULL if the file
+ *     cannot be opened. Every successful call needs a filecache_put.
+ */
+fc_file_t *filecache_get(char *filename, struct stat *sbufp)
+{
+    fc_file_t *fp, *old = NULL;
+    unsigned int b = hash(filename);
+    int fd;
+
+    P(&mutex);
+    for (fp = buckets[b]; fp; fp = fp->next) {
+        if (!strcmp(fp->name, filename)) {
+            if (is_current(fp, sbufp)) {
+                fp->refcnt++;
+                fp->used = ++tick;
+                V(&mutex);
+                return fp;
+            }
+            unlink_file(fp);   /* File changed on disk */
+            if (fp->refcnt == 0)
+                old = fp;
+            break;
+        }
+    }
+    V(&mutex);
+    if (old)
+        destroy(old);
+
+    /* Miss: open outside the lock */
+    if ((fd = open(filename, O_RDONLY, 0)) < 0)
+        return NULL;
+    fp = Malloc(sizeof(fc_file_t));
+    fp->name = Malloc(strlen(filename) + 1);
+    strcpy(fp->name, filename);
+    fp->fd = fd;
+    fp->size = sbufp->st_size;
+    fp->dev = sbufp->st_dev;
+    fp->ino = sbufp->st_ino;
+    fp->mtime = sbufp->st_mtim;
+    fp->refcnt = 1;
+    fp->stale = 0;
+
+    P(&mutex);
+    /* Another thread may have opened it meanwhile: keep ours uncached */
+    for (old = buckets[b]; old; old = old->next)
+        if (!strcmp(old->name, filename))
+            break;
+    if (old) {
+        fp->stale = 1;
+    }
+    else {
+        if (nfiles >= maxfiles)
+            evict_one();
+        fp->used = ++tick;
+        fp->next = buckets[b];
+        buckets[b] = fp;
+        nfiles++;
+    }
+    V(&mutex);
+    return fp;
+}
+
+/*
+ * filecache_put - Done with a descriptor returned by filecache_get.
+ *     The last user of a stale file closes it.
+ */
+void filecache_put(fc_file_t *fp)
+{
+    int last;
+
+    P(&mutex);
+    last = --fp->refcnt == 0 && fp->stale;
+    V(&mutex);
+    if (last)
+        destroy(fp);
+}
+
+/*
+ * hash - djb2 string hash
+ */
+static unsigned int hash(char *s)
+{
+    unsigned int h = 5381;
+
+    while (*s)
+        h = h * 33 + (unsigned char)*s++;
+    return h & (FILECACHE_BUCKETS - 1);
+}
+
+/*
+ * is_current - Does the cached descriptor still match the file on disk?
+ */
+static int is_current(fc_file_t *fp, struct stat *sbufp)
+{
+    return fp->ino == sbufp->st_ino && fp->dev == sbufp->st_dev &&
+        fp->size == sbufp->st_size &&
+        fp->mtime.tv_sec == sbufp->st_mtim.tv_sec &&
+        fp->mtime.tv_nsec == sbufp->st_mtim.tv_nsec;
+}
+
+/*
+ * unlink_file - Remove fp from the table and mark it stale, so the last
+ *     request using it closes it. Caller holds mutex.
+ */
+static void unlink_file(fc_file_t *fp)
+{
+    fc_file_t **pp;
+
+    for (pp = &buckets[hash(fp->name)]; *pp != fp; pp = &(*pp)->next)
+        ;
+    *pp = fp->next;
+    fp->stale = 1;
+    nfiles--;
+}
+
+/*
+ * evict_one - Close the least recently used file nobody is sending.
+ *     Caller holds mutex.
+ */
+static void evict_one(void)
+{
+    fc_file_t *fp, *victim = NULL;
+    int b;
+
+    for (b = 0; b < FILECACHE_BUCKETS; b++)
+        for (fp = buckets[b]; fp; fp = fp->next)
+            if (fp->refcnt == 0 && (!victim || fp->used < victim->used))
+                victim = fp;
+    if (victim) {
+        unlink_file(victim);
+        destroy(victim);
+    }
+}
+
+/*
+ * destroy - Close and free a file that is out of the table and unused
+ */
+static void destroy(fc_file_t *fp)
+{
+    Close(fp->fd);
+    Free(fp->name);
+    Free(fp);
+}
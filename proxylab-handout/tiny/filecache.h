@@ -0,0 +1,29 @@
+/*
+ * filecache.h - Cache of open descriptors for the files tiny serves
+ */
+#ifndef __FILECACHE_H__
+#define __FILECACHE_H__
+
+#include "csapp.h"
+
+#define FILECACHE_MAX 256  /* Default number of files kept open */
+
+/* One open file, shared by every request that serves it */
+typedef struct fc_file {
+    char *name;
+    int fd;
+    off_t size;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    int refcnt;               /* Requests using fd right now */
+    int stale;                /* Dropped from the cache, close when unused */
+    unsigned long used;       /* Clock value of the last lookup */
+    struct fc_file *next;
+} fc_file_t;
+
+void filecache_init(int maxfiles);
+fc_file_t *filecache_get(char *filename, struct stat *sbufp);
+void filecache_put(fc_file_t *fp);
+
+#endif /* __FILECACHE_H__ */
@@ -1,112 +1,446 @@
 /* $begin tinymain */
 /*
- * tiny.c - A simple, iterative HTTP/1.0 Web server that uses the 
+ * tiny.c - A simple, concurrent HTTP/1.0 Web server that uses the 
  *     GET method to serve static and dynamic content.
+ *
+ *     Connections are served by one of two models, picked at startup:
+ *
+ *     - threads (default): the main thread accepts connections into a
+ *       bounded buffer (sbuf.c) and a pool of worker threads serves
+ *       them, one connection per worker until it closes.
+ *     - events (-e): every worker waits on one shared epoll instance.
+ *       Connections are registered with EPOLLONESHOT, so exactly one
+ *       worker handles a readable connection; it reads what has arrived
+ *       without blocking, answers the requests that are whole and
+ *       re-arms it. Idle keep-alive connections, and clients still
+ *       sending a request, cost no thread.
+ *
+ *     Static content is served on persistent connections when the client
+ *     asks for "Connection: keep-alive". A connection that goes
+ *     KEEPALIVE_SECS without a whole request is closed.
+ *
+ *     Static files are sent with sendfile() from descriptors kept open
+ *     in a file cache (filecache.c), so a hot file is never reopened or
+ *     copied through user space. A request for one byte range of a file
+ *     ("Range: bytes=a-b") gets 206 Partial Content with just those bytes.
+ *
+ *     In the threaded model the acceptor and the workers each drive an
+ *     io_uring instance (csapp.c): bursts of connections are accepted
+ *     with one system call, and a worker waits for and reads the next
+ *     request on a persistent connection with one. -U uses plain system
+ *     calls instead.
  */
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
 #include "csapp.h"
+#include "sbuf.h"
+#include "filecache.h"
 
-void doit(int fd);
-void read_requesthdrs(rio_t *rp);
+#define KEEPALIVE_SECS 5
+#define NTHREADS 8
+#define SBUFSIZE 64
+#define ACCEPT_BATCH 16         /* Most connections accepted at once */
+
+/* A connection in the event model */
+typedef struct conn {
+    int fd;
+    rio_t rio;
+    time_t since;               /* Accepted or last request answered */
+    struct conn *prev, *next;   /* In the waiting list while armed */
+} conn_t;
+
+int doit(int fd, rio_t *rp);
+int read_requesthdrs(rio_t *rp, char *range);
+int next_request_ready(rio_t *rp);
 int parse_uri(char *uri, char *filename, char *cgiargs);
-void serve_static(int fd, char *filename, int filesize);
+void serve_static(int fd, char *filename, struct stat *sbufp, int keepalive,
+                  char *range);
+int parse_range(char *range, off_t size, off_t *firstp, off_t *lastp);
+int send_file(int fd, int srcfd, off_t offset, size_t count);
 void get_filetype(char *filename, char *filetype);
 void serve_dynamic(int fd, char *filename, char *cgiargs);
 void clienterror(int fd, char *cause, char *errnum, 
 		 char *shortmsg, char *longmsg);
+void *thread(void *vargp);
+void event_run(int listenfd, int nthreads);
+void *event_thread(void *vargp);
+void accept_conns(void);
+int fill_request(conn_t *c);
+int request_buffered(rio_t *rp);
+void arm(int op, int fd, conn_t *c);
+void *reaper(void *vargp);
+
+static int verbose = 1;     /* Log requests and responses to stdout */
+static sbuf_t sbuf;         /* Accepted connections (threaded model) */
+static int epfd;            /* Shared epoll instance (event model) */
+static conn_t waiting = { .prev = &waiting, .next = &waiting };
+                            /* Armed connections, for the reaper */
+static pthread_mutex_t waiting_lock = PTHREAD_MUTEX_INITIALIZER;
+static int listenfd;
+static int use_uring = 1;   /* Threads use io_uring if available (-U) */
 
 int main(int argc, char **argv) 
 {
-    int listenfd, connfd;
+    int connfds[ACCEPT_BATCH], i, n, opt, nthreads = NTHREADS, eventmode = 0;
     char hostname[MAXLINE], port[MAXLINE];
     socklen_t clientlen;
     struct sockaddr_storage clientaddr;
+    pthread_t tid;
 
     /* Check command line args */
-    if (argc != 2) {
-	fprintf(stderr, "usage: %s <port>\n", argv[0]);
+    while ((opt = getopt(argc, argv, "t:eqU")) != -1) {
+        switch (opt) {
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        case 'e':
+            eventmode = 1;
+            break;
+        case 'q':
+            verbose = 0;
+            break;
+        case 'U':
+            use_uring = 0;
+            break;
+        default:
+            nthreads = 0;
+            break;
+        }
+    }
+    if (optind != argc - 1 || nthreads <= 0) {
+	fprintf(stderr, "usage: %s [-t threads] [-e] [-q] [-U] <port>\n", argv[0]);
 	exit(1);
     }
 
-    listenfd = Open_listenfd(argv[1]);
+    Signal(SIGPIPE, SIG_IGN);  /* A closed client is just a write error */
+    filecache_init(FILECACHE_MAX);
+    listenfd = Open_listenfd(argv[optind]);
+    if (eventmode)
+        event_run(listenfd, nthreads);
+
+    sbuf_init(&sbuf, SBUFSIZE);
+    for (i = 0; i < nthreads; i++)
+        Pthread_create(&tid, NULL, thread, NULL);
+    if (use_uring)
+        rio_uring_init(RIO_URING_ENTRIES);
     while (1) {
-	clientlen = sizeof(clientaddr);
-	connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen); //line:netp:tiny:accept
-        Getnameinfo((SA *) &clientaddr, clientlen, hostname, MAXLINE, 
-                    port, MAXLINE, 0);
-        printf("Accepted connection from (%s, %s)\n", hostname, port);
-	doit(connfd);                                             //line:netp:tiny:doit
-	Close(connfd);                                            //line:netp:tiny:close
+	if ((n = rio_acceptn(listenfd, connfds, ACCEPT_BATCH)) < 0) //line:netp:tiny:accept
+            unix_error("Accept error");
+        for (i = 0; i < n; i++) {
+            if (verbose) {
+                clientlen = sizeof(clientaddr);
+                getpeername(connfds[i], (SA *)&clientaddr, &clientlen);
+                Getnameinfo((SA *) &clientaddr, clientlen, hostname, MAXLINE, 
+                            port, MAXLINE, 0);
+                printf("Accepted connection from (%s, %s)\n", hostname, port);
+            }
+            sbuf_insert(&sbuf, connfds[i]);
+        }
     }
 }
 /* $end tinymain */
 
+/*
+ * thread - worker of the threaded model: serve one connection at a time
+ */
+void *thread(void *vargp)
+{
+    int connfd;
+    rio_t rio;
+
+    Pthread_detach(pthread_self());
+    if (use_uring)
+        rio_uring_init(RIO_URING_ENTRIES);
+    while (1) {
+        connfd = sbuf_remove(&sbuf);
+        rio_readinitb(&rio, connfd);
+	while (doit(connfd, &rio) && next_request_ready(&rio)) //line:netp:tiny:doit
+	    ;
+	Close(connfd);                                            //line:netp:tiny:close
+    }
+    return NULL;
+}
+
+/*
+ * next_request_ready - wait for the next request on a persistent
+ *     connection and read it (a pipelined one may be buffered already).
+ *     Returns 0 if the connection closed or stayed idle too long, so
+ *     the caller should close it.
+ */
+int next_request_ready(rio_t *rp)
+{
+    return rio_fillb(rp, KEEPALIVE_SECS * 1000) > 0;
+}
+
+/*
+ * event_run - serve forever with nthreads workers sharing one epoll
+ *     instance. The listening socket is non-blocking and one-shot as
+ *     well, so only one worker accepts at a time.
+ */
+void event_run(int fd, int nthreads)
+{
+    int i;
+    pthread_t tid;
+
+    if ((epfd = epoll_create1(0)) < 0)
+        unix_error("epoll_create1 error");
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    arm(EPOLL_CTL_ADD, fd, NULL);
+    Pthread_create(&tid, NULL, reaper, NULL);
+    for (i = 0; i < nthreads - 1; i++)
+        Pthread_create(&tid, NULL, event_thread, NULL);
+    event_thread(NULL);
+}
+
+/*
+ * event_thread - worker of the event model. Takes one ready connection
+ *     at a time, so the other workers pick up the rest.
+ */
+void *event_thread(void *vargp)
+{
+    struct epoll_event ev;
+    conn_t *c;
+    int rc, keepalive;
+
+    while (1) {
+        if (epoll_wait(epfd, &ev, 1, -1) < 1)
+            continue;
+        if (!(c = ev.data.ptr)) {
+            accept_conns();
+            continue;
+        }
+
+        /* Take it off the waiting list, so the reaper leaves it alone */
+        pthread_mutex_lock(&waiting_lock);
+        c->prev->next = c->next;
+        c->next->prev = c->prev;
+        c->prev = c->next = c;
+        pthread_mutex_unlock(&waiting_lock);
+
+        /* Answer the whole requests that have arrived, then wait again */
+        keepalive = (rc = fill_request(c)) >= 0;
+        while (keepalive && request_buffered(&c->rio)) {
+            keepalive = doit(c->fd, &c->rio);
+            c->since = time(NULL);
+        }
+        if (keepalive && rc > 0) {
+            arm(EPOLL_CTL_MOD, c->fd, c);
+        }
+        else {
+            Close(c->fd);
+            Free(c);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * accept_conns - accept every pending connection, then re-arm the
+ *     listening socket. Accepted sockets stay blocking, for writes;
+ *     requests are read from them with MSG_DONTWAIT.
+ */
+void accept_conns(void)
+{
+    int connfd;
+    conn_t *c;
+
+    while ((connfd = accept(listenfd, NULL, NULL)) >= 0) {
+        c = Malloc(sizeof(conn_t));
+        c->fd = connfd;
+        c->since = time(NULL);
+        rio_readinitb(&c->rio, connfd);
+        arm(EPOLL_CTL_ADD, connfd, c);
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        fprintf(stderr, "accept error: %s\n", strerror(errno));
+    arm(EPOLL_CTL_MOD, listenfd, NULL);
+}
+
+/*
+ * fill_request - read whatever has arrived on c without blocking, after
+ *     the bytes its buffer still holds
+ *     return 1 if the connection is still open, 0 on EOF or when the
+ *     buffer filled up without a whole request (answer what is buffered,
+ *     then close), -1 on error
+ */
+int fill_request(conn_t *c)
+{
+    rio_t *rp = &c->rio;
+    ssize_t n;
+
+    if (rp->rio_bufptr != rp->rio_buf) {
+        memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+        rp->rio_bufptr = rp->rio_buf;
+    }
+    while (rp->rio_cnt < rp->rio_bufsize) {
+        n = recv(c->fd, rp->rio_buf + rp->rio_cnt,
+                 rp->rio_bufsize - rp->rio_cnt, MSG_DONTWAIT);
+        if (n > 0)
+            rp->rio_cnt += n;
+        else if (n == 0)
+            return 0;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 1;
+        else if (errno != EINTR)
+            return -1;
+    }
+    return request_buffered(rp);
+}
+
+/*
+ * request_buffered - does rp hold a whole request line and headers?
+ */
+int request_buffered(rio_t *rp)
+{
+    int i;
+
+    for (i = 0; i + 4 <= rp->rio_cnt; i++)
+        if (!memcmp(rp->rio_bufptr + i, "\r\n\r\n", 4))
+            return 1;
+    return 0;
+}
+
+/*
+ * arm - wait for the next request on fd, putting its connection c on the
+ *     waiting list (c is NULL for the listener)
+ */
+void arm(int op, int fd, conn_t *c)
+{
+    struct epoll_event ev;
+
+    if (c) {
+        pthread_mutex_lock(&waiting_lock);
+        c->prev = waiting.prev;
+        c->next = &waiting;
+        waiting.prev->next = c;
+        waiting.prev = c;
+        pthread_mutex_unlock(&waiting_lock);
+    }
+
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = c;
+    if (epoll_ctl(epfd, op, fd, &ev) < 0)
+        unix_error("epoll_ctl error");
+}
+
+/*
+ * reaper - once a second, shut down every waiting connection that has
+ *     gone KEEPALIVE_SECS without a whole request. Its worker then reads
+ *     EOF and closes it, so only workers ever free a connection.
+ */
+void *reaper(void *vargp)
+{
+    conn_t *c, *next;
+    time_t now;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+        sleep(1);
+        now = time(NULL);
+        pthread_mutex_lock(&waiting_lock);
+        for (c = waiting.next; c != &waiting; c = next) {
+            next = c->next;
+            if (now - c->since >= KEEPALIVE_SECS) {
+                c->prev->next = c->next;
+                c->next->prev = c->prev;
+                c->prev = c->next = c;
+                shutdown(c->fd, SHUT_RDWR);
+            }
+        }
+        pthread_mutex_unlock(&waiting_lock);
+    }
+    return NULL;
+}
+
 /*
  * doit - handle one HTTP request/response transaction
+ *     return 1 if the connection may be kept open for another request
  */
 /* $begin doit */
-void doit(int fd) 
+int doit(int fd, rio_t *rp) 
 {
-    int is_static;
+    int is_static, keepalive;
     struct stat sbuf;
     char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
-    char filename[MAXLINE], cgiargs[MAXLINE];
-    rio_t rio;
+    char filename[MAXLINE], cgiargs[MAXLINE], range[MAXLINE];
 
     /* Read request line and headers */
-    Rio_readinitb(&rio, fd);
-    if (!Rio_readlineb(&rio, buf, MAXLINE))  //line:netp:doit:readrequest
-        return;
-    printf("%s", buf);
+    if (rio_readlineb(rp, buf, MAXLINE) <= 0)  //line:netp:doit:readrequest
+        return 0;
+    if (verbose)
+        printf("%s", buf);
     sscanf(buf, "%s %s %s", method, uri, version);       //line:netp:doit:parserequest
     if (strcasecmp(method, "GET")) {                     //line:netp:doit:beginrequesterr
         clienterror(fd, method, "501", "Not Implemented",
                     "Tiny does not implement this method");
-        return;
+        return 0;
     }                                                    //line:netp:doit:endrequesterr
-    read_requesthdrs(&rio);                              //line:netp:doit:readrequesthdrs
+    keepalive = read_requesthdrs(rp, range);                 //line:netp:doit:readrequesthdrs
 
     /* Parse URI from GET request */
     is_static = parse_uri(uri, filename, cgiargs);       //line:netp:doit:staticcheck
     if (stat(filename, &sbuf) < 0) {                     //line:netp:doit:beginnotfound
 	clienterror(fd, filename, "404", "Not found",
 		    "Tiny couldn't find this file");
-	return;
+	return 0;
     }                                                    //line:netp:doit:endnotfound
 
     if (is_static) { /* Serve static content */          
 	if (!(S_ISREG(sbuf.st_mode)) || !(S_IRUSR & sbuf.st_mode)) { //line:netp:doit:readable
 	    clienterror(fd, filename, "403", "Forbidden",
 			"Tiny couldn't read the file");
-	    return;
+	    return 0;
 	}
-	serve_static(fd, filename, sbuf.st_size);        //line:netp:doit:servestatic
+	serve_static(fd, filename, &sbuf, keepalive, range); //line:netp:doit:servestatic
+	return keepalive;
     }
     else { /* Serve dynamic content */
 	if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) { //line:netp:doit:executable
 	    clienterror(fd, filename, "403", "Forbidden",
 			"Tiny couldn't run the CGI program");
-	    return;
+	    return 0;
 	}
 	serve_dynamic(fd, filename, cgiargs);            //line:netp:doit:servedynamic
+	return 0;
     }
 }
 /* $end doit */
 
 /*
- * read_requesthdrs - read HTTP request headers
+ * read_requesthdrs - read HTTP request headers, copying the value of a
+ *     Range header into range ("" if there is none, or if If-Range makes
+ *     it conditional: Tiny sends no validators, so it never matches)
+ *     return 1 if the client asked for a persistent connection
  */
 /* $begin read_requesthdrs */
-void read_requesthdrs(rio_t *rp) 
+int read_requesthdrs(rio_t *rp, char *range) 
 {
-    char buf[MAXLINE];
+    char buf[MAXLINE], *value;
+    int keepalive = 0, ifrange = 0;
 
-    Rio_readlineb(rp, buf, MAXLINE);
-    printf("%s", buf);
+    range[0] = '\0';
+    if (rio_readlineb(rp, buf, MAXLINE) <= 0)
+        return 0;
+    if (verbose)
+        printf("%s", buf);
     while(strcmp(buf, "\r\n")) {          //line:netp:readhdrs:checkterm
-	Rio_readlineb(rp, buf, MAXLINE);
-	printf("%s", buf);
+	if (!strcasecmp(buf, "Connection: keep-alive\r\n"))
+	    keepalive = 1;
+	else if (!strncasecmp(buf, "Range:", 6)) {
+	    value = buf + 6 + strspn(buf + 6, " \t");
+	    value[strcspn(value, " \t\r\n")] = '\0';
+	    strcpy(range, value);
+	}
+	else if (!strncasecmp(buf, "If-Range:", 9))
+	    ifrange = 1;
+	if (rio_readlineb(rp, buf, MAXLINE) <= 0)
+	    return 0;
+        if (verbose)
+            printf("%s", buf);
     }
-    return;
+    if (ifrange)
+        range[0] = '\0';
+    return keepalive;
 }
 /* $end read_requesthdrs */
 
@@ -121,6 +455,8 @@ int parse_uri(char *uri, char *filename, char *cgiargs)
 
     if (!strstr(uri, "cgi-bin")) {  /* Static content */ //line:netp:parseuri:isstatic
 	strcpy(cgiargs, "");                             //line:netp:parseuri:clearcgi
+	if ((ptr = index(uri, '?')))                     /* Query is ignored */
+	    *ptr = '\0';
 	strcpy(filename, ".");                           //line:netp:parseuri:beginconvert1
 	strcat(filename, uri);                           //line:netp:parseuri:endconvert1
 	if (uri[strlen(uri)-1] == '/')                   //line:netp:parseuri:slashcheck
@@ -143,31 +479,169 @@ int parse_uri(char *uri, char *filename, char *cgiargs)
 /* $end parse_uri */
 
 /*
- * serve_static - copy a file back to the client 
+ * serve_static - copy a file back to the client, or just the part of it
+ *     that range asks for
  */
 /* $begin serve_static */
-void serve_static(int fd, char *filename, int filesize) 
+void serve_static(int fd, char *filename, struct stat *sbufp, int keepalive,
+                  char *range) 
 {
-    int srcfd;
-    char *srcp, filetype[MAXLINE], buf[MAXBUF];
+    fc_file_t *fp;
+    char filetype[MAXLINE], buf[MAXBUF];
+    off_t first = 0, last;
+    int n, rc = 0, more;
+    ssize_t k;
+
+    if (!(fp = filecache_get(filename, sbufp))) {
+        clienterror(fd, filename, "403", "Forbidden",
+                    "Tiny couldn't read the file");
+        return;
+    }
  
     /* Send response headers to client */
     get_filetype(filename, filetype);       //line:netp:servestatic:getfiletype
-    sprintf(buf, "HTTP/1.0 200 OK\r\n");    //line:netp:servestatic:beginserve
-    sprintf(buf, "%sServer: Tiny Web Server\r\n", buf);
-    sprintf(buf, "%sConnection: close\r\n", buf);
-    sprintf(buf, "%sContent-length: %d\r\n", buf, filesize);
-    sprintf(buf, "%sContent-type: %s\r\n\r\n", buf, filetype);
-    Rio_writen(fd, buf, strlen(buf));       //line:netp:servestatic:endserve
-    printf("Response headers:\n");
-    printf("%s", buf);
+    last = fp->size - 1;
+    if (range[0])
+        rc = parse_range(range, fp->size, &first, &last);
+    if (rc < 0) {
+        n = snprintf(buf, MAXBUF, "HTTP/1.0 416 Range Not Satisfiable\r\n"
+                     "Server: Tiny Web Server\r\n"
+                     "Connection: %s\r\n"
+                     "Content-range: bytes */%lld\r\n"
+                     "Content-length: 0\r\n\r\n",
+                     keepalive ? "keep-alive" : "close",
+                     (long long)fp->size);
+    }
+    else if (rc > 0) {
+        n = snprintf(buf, MAXBUF, "HTTP/1.0 206 Partial Content\r\n"
+                     "Server: Tiny Web Server\r\n"
+                     "Connection: %s\r\n"
+                     "Accept-ranges: bytes\r\n"
+                     "Content-range: bytes %lld-%lld/%lld\r\n"
+                     "Content-length: %lld\r\n"
+                     "Content-type: %s\r\n\r\n",
+                     keepalive ? "keep-alive" : "close",
+                     (long long)first, (long long)last,
+                     (long long)fp->size, (long long)(last - first + 1),
+                     filetype);
+    }
+    else {
+        n = snprintf(buf, MAXBUF, "HTTP/1.0 200 OK\r\n"
+                     "Server: Tiny Web Server\r\n"
+                     "Connection: %s\r\n"
+                     "Accept-ranges: bytes\r\n"
+                     "Content-length: %lld\r\n"
+                     "Content-type: %s\r\n\r\n",
+                     keepalive ? "keep-alive" : "close",
+                     (long long)fp->size, filetype);
+    }
+    /* MSG_MORE lets the kernel put the headers in the body's first
+       packet, so only use it when body bytes follow: nothing else would
+       push a corked header out. Whatever a short send left goes out
+       after it. */
+    more = rc >= 0 && last >= first ? MSG_MORE : 0;
+    if ((k = send(fd, buf, n, more)) < 0)
+        k = 0;
+    if (k != n && rio_writen(fd, buf + k, n - k) != n - k) {
+        filecache_put(fp);                  //line:netp:servestatic:endserve
+        return;
+    }
+    if (verbose) {
+        printf("Response headers:\n");
+        printf("%s", buf);
+    }
 
     /* Send response body to client */
-    srcfd = Open(filename, O_RDONLY, 0);    //line:netp:servestatic:open
-    srcp = Mmap(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0);//line:netp:servestatic:mmap
-    Close(srcfd);                           //line:netp:servestatic:close
-    Rio_writen(fd, srcp, filesize);         //line:netp:servestatic:write
-    Munmap(srcp, filesize);                 //line:netp:servestatic:munmap
+    if (rc >= 0 && send_file(fd, fp->fd, first, last - first + 1) < 0 &&
+        verbose)
+        fprintf(stderr, "send_file error: %s\n", strerror(errno));
+    filecache_put(fp);
+}
+
+/*
+ * parse_range - parse a Range header value asking for one byte range
+ *     ("bytes=first-last", "bytes=first-" or "bytes=-suffix") of a
+ *     size byte file, clamped to the file, into [*firstp, *lastp]
+ *     return 1 for a range to send, -1 if it starts past the end of the
+ *     file, 0 if the header is malformed or asks for several ranges or
+ *     another unit, so the whole file is sent instead
+ */
+int parse_range(char *range, off_t size, off_t *firstp, off_t *lastp)
+{
+    char *end;
+    long long first, last;
+
+    if (strncasecmp(range, "bytes=", 6) || strchr(range, ','))
+        return 0;
+    range += 6;
+
+    if (*range == '-') {  /* The last n bytes */
+        if (!isdigit((unsigned char)range[1]))
+            return 0;
+        last = strtoll(range + 1, &end, 10);
+        if (*end)
+            return 0;
+        if (last == 0 || size == 0)
+            return -1;
+        *firstp = last < size ? size - last : 0;
+        *lastp = size - 1;
+        return 1;
+    }
+
+    if (!isdigit((unsigned char)*range))
+        return 0;
+    first = strtoll(range, &end, 10);
+    if (*end++ != '-')
+        return 0;
+    last = size - 1;
+    if (*end) {
+        if (!isdigit((unsigned char)*end))
+            return 0;
+        last = strtoll(end, &end, 10);
+        if (*end || last < first)
+            return 0;
+        if (last > size - 1)
+            last = size - 1;
+    }
+    if (first >= size)
+        return -1;
+    *firstp = first;
+    *lastp = last;
+    return 1;
+}
+
+/*
+ * send_file - write count bytes of srcfd, starting at offset, to fd.
+ *     Uses sendfile(), falling back to pread/write where it is not
+ *     supported. Returns 0 on success, -1 on error.
+ */
+int send_file(int fd, int srcfd, off_t offset, size_t count)
+{
+    char buf[MAXBUF];
+    ssize_t n;
+
+    while (count > 0) {
+        if ((n = sendfile(fd, srcfd, &offset, count)) > 0) {
+            count -= n;
+            continue;
+        }
+        if (n == 0)
+            return -1;                      /* File shrank under us */
+        if (errno == EINTR)
+            continue;
+        if (errno != EINVAL && errno != ENOSYS)
+            return -1;
+
+        /* No sendfile for this pair of descriptors */
+        while (count > 0) {
+            n = pread(srcfd, buf, count < MAXBUF ? count : MAXBUF, offset);
+            if (n <= 0 || rio_writen(fd, buf, n) != n)
+                return -1;
+            offset += n;
+            count -= n;
+        }
+    }
+    return 0;
 }
 
 /*
@@ -195,20 +669,22 @@ void get_filetype(char *filename, char *filetype)
 void serve_dynamic(int fd, char *filename, char *cgiargs) 
 {
     char buf[MAXLINE], *emptylist[] = { NULL };
+    pid_t pid;
 
     /* Return first part of HTTP response */
-    sprintf(buf, "HTTP/1.0 200 OK\r\n"); 
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Server: Tiny Web Server\r\n");
-    Rio_writen(fd, buf, strlen(buf));
+    sprintf(buf, "HTTP/1.0 200 OK\r\n"
+            "Server: Tiny Web Server\r\n");
+    if (rio_writen(fd, buf, strlen(buf)) < 0)
+        return;
   
-    if (Fork() == 0) { /* Child */ //line:netp:servedynamic:fork
+    if ((pid = Fork()) == 0) { /* Child */ //line:netp:servedynamic:fork
 	/* Real server would set all CGI vars here */
 	setenv("QUERY_STRING", cgiargs, 1); //line:netp:servedynamic:setenv
 	Dup2(fd, STDOUT_FILENO);         /* Redirect stdout to client */ //line:netp:servedynamic:dup2
 	Execve(filename, emptylist, environ); /* Run CGI program */ //line:netp:servedynamic:execve
     }
-    Wait(NULL); /* Parent waits for and reaps child */ //line:netp:servedynamic:wait
+    /* Parent waits for and reaps its own child only */
+    Waitpid(pid, NULL, 0);                 //line:netp:servedynamic:wait
 }
 /* $end serve_dynamic */
 
@@ -219,22 +695,24 @@ void serve_dynamic(int fd, char *filename, char *cgiargs)
 void clienterror(int fd, char *cause, char *errnum, 
 		 char *shortmsg, char *longmsg) 
 {
-    char buf[MAXLINE], body[MAXBUF];
+    char buf[MAXLINE], body[MAXBUF], out[MAXBUF];
+    rio_wbuf_t wb;
+    int n, bodylen;
 
     /* Build the HTTP response body */
-    sprintf(body, "<html><title>Tiny Error</title>");
-    sprintf(body, "%s<body bgcolor=""ffffff"">\r\n", body);
-    sprintf(body, "%s%s: %s\r\n", body, errnum, shortmsg);
-    sprintf(body, "%s<p>%s: %s\r\n", body, longmsg, cause);
-    sprintf(body, "%s<hr><em>The Tiny Web server</em>\r\n", body);
-
-    /* Print the HTTP response */
-    sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Content-type: text/html\r\n");
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-    Rio_writen(fd, buf, strlen(buf));
-    Rio_writen(fd, body, strlen(body));
+    bodylen = snprintf(body, MAXBUF, "<html><title>Tiny Error</title>"
+                       "<body bgcolor=""ffffff"">\r\n"
+                       "%s: %s\r\n"
+                       "<p>%s: %.*s\r\n"
+                       "<hr><em>The Tiny Web server</em>\r\n",
+                       errnum, shortmsg, longmsg, MAXLINE, cause);
+
+    /* Print the HTTP response, headers and body in one write */
+    n = sprintf(buf, "HTTP/1.0 %s %s\r\n"
+                "Content-type: text/html\r\n"
+                "Content-length: %d\r\n\r\n", errnum, shortmsg, bodylen);
+    rio_writeinitb(&wb, fd, out, MAXBUF);
+    if (rio_writeb(&wb, buf, n) == n && rio_writeb(&wb, body, bodylen) == bodylen)
+        rio_flush(&wb);
 }
 /* $end clienterror */
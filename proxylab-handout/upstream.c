@@ -0,0 +1,141 @@
+/*
+ * upstream.c - Pool of idle keep-alive connections to origin servers.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ * Every origin (host:port) gets a small stack of idle descriptors, so
+ * the most recently used connection is handed out first. Connections
+ * idle for longer than the timeout, or already closed by the server,
+ * are dropped when they are found. One semaphore guards the whole pool;
+ * it is only held for list manipulation, never for I/O.
+ *
+ */
+
+#include "upstream.h"
+
+/* One idle connection */
+typedef struct {
+    int fd;
+    time_t since;       /* When it was returned to the pool */
+} idle_conn_t;
+
+/* All idle connections to one origin */
+typedef struct origin {
+    char *key;          /* host:port */
+    idle_conn_t *idle;  /* Stack of max_idle slots */
+    int nidle;
+    struct origin *next;
+} origin_t;
+
+/* Global pool state */
+static origin_t *origins = NULL;
+static int max_idle = UPSTREAM_MAX_IDLE;
+static int idle_timeout = UPSTREAM_IDLE_TIMEOUT;
+static sem_t mutex;
+
+/* Helpers */
+static origin_t *find_origin(char *host, char *port, int create);
+static int is_alive(int fd);
+
+
+/*
+ * upstream_init - Set the pool limits. Must run before any other call.
+ */
+void upstream_init(int maxidle, int idletimeout) {
+    max_idle = maxidle;
+    idle_timeout = idletimeout;
+    origins = NULL;
+    Sem_init(&mutex, 0, 1);
+}
+
+/*
+ * upstream_get - Take an idle connection to host:port out of the pool.
+ *          Returns the descriptor, or -1 when there is none.
+ */
+int upstream_get(char *host, char *port) {
+    origin_t *op;
+    idle_conn_t conn;
+    time_t now = time(NULL);
+
+    while (1) {
+        P(&mutex);
+        op = find_origin(host, port, 0);
+        if (!op || op->nidle == 0) {
+            V(&mutex);
+            return -1;
+        }
+        conn = op->idle[--op->nidle];
+        V(&mutex);
+
+        if (now - conn.since <= idle_timeout && is_alive(conn.fd)) {
+            return conn.fd;
+        }
+        Close(conn.fd);
+    }
+}
+
+/*
+ * upstream_put - Return a reusable connection to the pool. If the origin
+ *          already has max_idle idle connections, the oldest one is closed.
+ */
+void upstream_put(char *host, char *port, int fd) {
+    origin_t *op;
+    int victim = -1;
+
+    P(&mutex);
+    op = find_origin(host, port, 1);
+    if (op->nidle == max_idle) {
+        victim = op->idle[0].fd;
+        memmove(op->idle, op->idle + 1, (max_idle - 1) * sizeof(idle_conn_t));
+        op->nidle--;
+    }
+    op->idle[op->nidle].fd = fd;
+    op->idle[op->nidle].since = time(NULL);
+    op->nidle++;
+    V(&mutex);
+
+    if (victim >= 0) {
+        Close(victim);
+    }
+}
+
+
+/*
+ * find_origin - Find the entry for host:port, creating it if asked.
+ *          Caller must hold mutex.
+ */
+static origin_t *find_origin(char *host, char *port, int create) {
+    origin_t *op;
+    size_t hostlen = strlen(host);
+
+    for (op = origins; op; op = op->next) {
+        if (!strncmp(op->key, host, hostlen) && op->key[hostlen] == ':' &&
+            !strcmp(op->key + hostlen + 1, port)) {
+            return op;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    op = Malloc(sizeof(origin_t));
+    op->key = Malloc(hostlen + strlen(port) + 2);
+    sprintf(op->key, "%s:%s", host, port);
+    op->idle = Calloc(max_idle, sizeof(idle_conn_t));
+    op->nidle = 0;
+    op->next = origins;
+    origins = op;
+    return op;
+}
+
+/*
+ * is_alive - An idle connection should have nothing to read. EOF or
+ *          unexpected data both mean it cannot be reused.
+ */
+static int is_alive(int fd) {
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
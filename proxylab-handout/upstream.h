@@ -0,0 +1,21 @@
+/*
+ * upstream.h - Pool of idle keep-alive connections to origin servers.
+ *
+ * Name: Aihua Peng
+ * AndrewID: aihuap
+ *
+ */
+#ifndef __UPSTREAM_H__
+#define __UPSTREAM_H__
+
+#include "csapp.h"
+
+/* Defaults for the pool limits */
+#define UPSTREAM_MAX_IDLE 8         /* Idle connections kept per origin */
+#define UPSTREAM_IDLE_TIMEOUT 30    /* Seconds an idle connection is kept */
+
+void upstream_init(int max_idle, int idle_timeout);
+int upstream_get(char *host, char *port);
+void upstream_put(char *host, char *port, int fd);
+
+#endif /* __UPSTREAM_H__ */